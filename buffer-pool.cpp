@@ -0,0 +1,113 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "flash-bench.h"
+#include "buffer-pool.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+// Warnings are given only once, since a pool is allocated for every worker.
+static bool huge_page_warning_given = false;
+static bool lock_warning_given = false;
+
+BufferPool::BufferPool() {
+	memory = NULL;
+	nu_buffers = 0;
+	buffer_size = 0;
+}
+
+BufferPool::~BufferPool() {
+	Free();
+}
+
+// Map anonymous memory aligned to a huge page boundary, so that transparent
+// huge pages can be used for the whole mapping.
+
+static char *MapAlignedToHugePage(size_t size) {
+	size_t size_with_margin = size + HUGE_PAGE_SIZE;
+	char *p = (char *)mmap(NULL, size_with_margin, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, - 1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	char *aligned = (char *)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) &
+		~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	if (aligned > p)
+		munmap(p, aligned - p);
+	if (p + size_with_margin > aligned + size)
+		munmap(aligned + size, p + size_with_margin - (aligned + size));
+	return aligned;
+}
+
+void BufferPool::Allocate(int _nu_buffers, size_t _buffer_size, int flags) {
+	Free();
+	nu_buffers = _nu_buffers;
+	buffer_size = _buffer_size;
+	buffer_stride = (buffer_size + BUFFER_POOL_ALIGNMENT - 1) &
+		~(size_t)(BUFFER_POOL_ALIGNMENT - 1);
+	mapping_size = buffer_stride * nu_buffers;
+	memory = NULL;
+	if (flags & BUFFER_POOL_HUGE_PAGES) {
+		mapping_size = (mapping_size + HUGE_PAGE_SIZE - 1) &
+			~(size_t)(HUGE_PAGE_SIZE - 1);
+		// Use reserved huge pages (/proc/sys/vm/nr_hugepages) when available,
+		// otherwise transparent huge pages.
+		memory = (char *)mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, - 1, 0);
+		if (memory == MAP_FAILED) {
+			memory = MapAlignedToHugePage(mapping_size);
+			if (memory != NULL && madvise(memory, mapping_size, MADV_HUGEPAGE) != 0 &&
+			!huge_page_warning_given) {
+				Message("Warning: Huge pages not available for I/O buffers.\n");
+				huge_page_warning_given = true;
+			}
+		}
+	}
+	else {
+		memory = (char *)mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, - 1, 0);
+		if (memory == MAP_FAILED)
+			memory = NULL;
+	}
+	if (memory == NULL)
+		FatalError("Out of memory.\n");
+	// Fault in all pages.
+	memset(memory, 0, mapping_size);
+	if ((flags & BUFFER_POOL_LOCK) && mlock(memory, mapping_size) != 0 &&
+	!lock_warning_given) {
+		Message("Warning: Could not lock I/O buffers in memory (see ulimit -l).\n");
+		lock_warning_given = true;
+	}
+}
+
+void BufferPool::Free() {
+	if (memory == NULL)
+		return;
+	munmap(memory, mapping_size);
+	memory = NULL;
+	nu_buffers = 0;
+}
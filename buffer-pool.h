@@ -0,0 +1,64 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Pool of I/O buffers. Requires stdint.h to be included first.
+//
+// All buffers of a pool are allocated in a single anonymous mapping, and are
+// aligned to (and a multiple of) BUFFER_POOL_ALIGNMENT bytes, which satisfies
+// the alignment requirements of O_DIRECT on all common devices. The memory is
+// faulted in when the pool is allocated, so that page faults do not occur
+// during the tests. Optionally, the mapping is backed by 2MB huge pages, to
+// avoid TLB misses with large buffers, and locked in memory.
+
+#define BUFFER_POOL_ALIGNMENT 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+enum {
+	BUFFER_POOL_HUGE_PAGES = 0x1,
+	BUFFER_POOL_LOCK = 0x2
+};
+
+class BufferPool {
+private :
+	char *memory;
+	size_t mapping_size;
+	size_t buffer_stride;
+	int nu_buffers;
+	size_t buffer_size;
+public :
+	BufferPool();
+	~BufferPool();
+	// Allocate the given number of buffers of at least buffer_size bytes each,
+	// with flags of the form BUFFER_POOL_*. When huge pages or locking are not
+	// available, a warning is given and the pool is allocated without them.
+	void Allocate(int nu_buffers, size_t buffer_size, int flags);
+	void Free();
+	int GetNumberOfBuffers() const {
+		return nu_buffers;
+	}
+	size_t GetBufferSize() const {
+		return buffer_size;
+	}
+	char *Get(int i) const {
+		return memory + i * buffer_stride;
+	}
+	// Return the index of a buffer of the pool.
+	int GetIndex(const char *buffer) const {
+		return (buffer - memory) / buffer_stride;
+	}
+};
@@ -226,8 +226,11 @@ static void calc_cpu_usage_pct(const ProcessStat *cur_usage,
 			       double *ucpu_usage, double *scpu_usage,
 				double *thread_ucpu_usage, double *thread_scpu_usage)
 {
-	const uint64_t total_time_diff = cur_usage->cpu_total_time -
+	uint64_t total_time_diff = cur_usage->cpu_total_time -
 	    last_usage->cpu_total_time;
+	// Avoid dividing by zero when no clock tick has passed (very short tests).
+	if (total_time_diff == 0)
+		total_time_diff = 1;
 
 	*ucpu_usage = 100 * (((cur_usage->process_stats.utime_ticks +
 			       cur_usage->process_stats.cutime_ticks)
@@ -332,6 +335,14 @@ void CPUStat::Update() {
 	get_usage(pid, usage);
 }
 
+int CPUStat::GetNumberOfThreads() const {
+	return process_stat->num_threads;
+}
+
+int CPUStat::GetThreadID(int i) const {
+	return process_stat->thread_stats[i].pid;
+}
+
 CPUStat *AllocateCPUStat(int pid) {
 	CPUStat *st = new CPUStat(pid);
 	return st;
@@ -27,6 +27,11 @@ public :
 	CPUStat(int pid);
 	~CPUStat();
 	void Update();
+	// Return the number of threads of the process, and the thread ID of each
+	// thread, at the time of the last update. Per-thread CPU usage arrays
+	// are indexed in the same order.
+	int GetNumberOfThreads() const;
+	int GetThreadID(int i) const;
 	void GetTotalUsage(const CPUStat *cpust_previous, double *ucpu_usage, double *scpu_usage,
 		double *thread_ucpu_usage, double *thread_scpu_usage) const;
 	void GetTotalUsage(const CPUStat *cpust_previous, double *ucpu_usage, double *scpu_usage) const {
@@ -0,0 +1,173 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "data-pattern.h"
+
+static inline uint64_t SplitMix64(uint64_t *state) {
+	*state += 0x9E3779B97F4A7C15ULL;
+	uint64_t x = *state;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+void DataGenerator::Seed(uint64_t seed) {
+	uint64_t state = seed;
+	for (int i = 0; i < DATA_GENERATOR_LANES; i++) {
+		s0[i] = SplitMix64(&state);
+		s1[i] = SplitMix64(&state);
+	}
+	decision_state = SplitMix64(&state);
+}
+
+void DataGenerator::Generate(uint64_t *p, size_t n) {
+	// Local copies of the state allow the lanes to be kept in registers.
+	uint64_t a[DATA_GENERATOR_LANES];
+	uint64_t b[DATA_GENERATOR_LANES];
+	for (int j = 0; j < DATA_GENERATOR_LANES; j++) {
+		a[j] = s0[j];
+		b[j] = s1[j];
+	}
+	size_t i = 0;
+	for (; i + DATA_GENERATOR_LANES <= n; i += DATA_GENERATOR_LANES)
+		for (int j = 0; j < DATA_GENERATOR_LANES; j++) {
+			uint64_t x = a[j];
+			uint64_t y = b[j];
+			a[j] = y;
+			x ^= x << 23;
+			b[j] = x ^ y ^ (x >> 17) ^ (y >> 26);
+			p[i + j] = b[j] + y;
+		}
+	for (int j = 0; i < n; i++, j++) {
+		uint64_t x = a[j];
+		uint64_t y = b[j];
+		a[j] = y;
+		x ^= x << 23;
+		b[j] = x ^ y ^ (x >> 17) ^ (y >> 26);
+		p[i] = b[j] + y;
+	}
+	for (int j = 0; j < DATA_GENERATOR_LANES; j++) {
+		s0[j] = a[j];
+		s1[j] = b[j];
+	}
+}
+
+void DataGenerator::GenerateBytes(char *buffer, size_t size) {
+	// Buffers are normally aligned; handle any remainder separately.
+	Generate((uint64_t *)buffer, size / 8);
+	if ((size & 7) != 0) {
+		uint64_t word;
+		Generate(&word, 1);
+		memcpy(buffer + (size & ~(size_t)7), &word, size & 7);
+	}
+}
+
+double DataGenerator::NextDouble() {
+	return (double)(SplitMix64(&decision_state) >> 11) * (1.0d / 9007199254740992.0d);
+}
+
+DataPattern::DataPattern() {
+	type = DATA_PATTERN_RAMP;
+	fixed_value = 0;
+	compressibility = 0;
+	dedupe = 0;
+}
+
+void DataPattern::Fill(char *buffer, size_t size, DataGenerator *g) const {
+	switch (type) {
+	case DATA_PATTERN_RAMP :
+		for (size_t i = 0; i < size; i++)
+			buffer[i] = i & 0xFF;
+		return;
+	case DATA_PATTERN_ZEROS :
+		memset(buffer, 0, size);
+		return;
+	case DATA_PATTERN_FIXED :
+		memset(buffer, fixed_value, size);
+		return;
+	}
+	if (compressibility == 0 && dedupe == 0) {
+		g->GenerateBytes(buffer, size);
+		return;
+	}
+	size_t zero_size = (size_t)(DATA_PATTERN_CHUNK_SIZE * compressibility / 100.0);
+	for (size_t offset = 0; offset < size; offset += DATA_PATTERN_CHUNK_SIZE) {
+		size_t chunk_size = size - offset;
+		if (chunk_size > DATA_PATTERN_CHUNK_SIZE)
+			chunk_size = DATA_PATTERN_CHUNK_SIZE;
+		char *chunk = buffer + offset;
+		if (dedupe > 0 && g->NextDouble() * 100.0 < dedupe) {
+			// Generate one of a small set of chunks, each with a fixed seed.
+			DataGenerator d;
+			d.Seed(0x44454455ULL + (uint64_t)(g->NextDouble() *
+				DATA_PATTERN_DEDUPE_CHUNKS));
+			d.GenerateBytes(chunk, chunk_size);
+		}
+		else
+			g->GenerateBytes(chunk, chunk_size);
+		// The zero part is at the end of the chunk.
+		if (zero_size > 0) {
+			size_t random_size = DATA_PATTERN_CHUNK_SIZE - zero_size;
+			if (random_size < chunk_size)
+				memset(chunk + random_size, 0, chunk_size - random_size);
+		}
+	}
+}
+
+const char *DataPattern::GetDescription(char *s) const {
+	switch (type) {
+	case DATA_PATTERN_RAMP :
+		return "ramp";
+	case DATA_PATTERN_ZEROS :
+		return "zeros";
+	case DATA_PATTERN_FIXED :
+		sprintf(s, "fixed 0x%02X", fixed_value);
+		return s;
+	}
+	strcpy(s, "random");
+	if (compressibility > 0)
+		sprintf(s + strlen(s), ", %g%% compressible", compressibility);
+	if (dedupe > 0)
+		sprintf(s + strlen(s), ", %g%% dedupe", dedupe);
+	return s;
+}
+
+bool ParseDataPattern(const char *spec, DataPattern *pattern) {
+	if (strcmp(spec, "ramp") == 0)
+		pattern->type = DATA_PATTERN_RAMP;
+	else if (strcmp(spec, "zeros") == 0)
+		pattern->type = DATA_PATTERN_ZEROS;
+	else if (strcmp(spec, "random") == 0)
+		pattern->type = DATA_PATTERN_RANDOM;
+	else if (strncmp(spec, "fixed:", 6) == 0) {
+		char *end;
+		long value = strtol(&spec[6], &end, 0);
+		if (spec[6] == '\0' || *end != '\0' || value < 0 || value > 255)
+			return false;
+		pattern->type = DATA_PATTERN_FIXED;
+		pattern->fixed_value = value;
+	}
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,78 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Data patterns written to the test file. Requires stdint.h to be included
+// first.
+
+enum {
+	DATA_PATTERN_RAMP = 0,		// Repeating byte values 0 to 255 (the default).
+	DATA_PATTERN_ZEROS = 1,
+	DATA_PATTERN_FIXED = 2,		// A single repeated byte value.
+	DATA_PATTERN_RANDOM = 3,	// Fresh pseudo-random data for every write.
+	NU_DATA_PATTERNS
+};
+
+// Compressibility and deduplication of random data are applied per chunk of
+// this size, which matches the granularity of most SSD controllers.
+#define DATA_PATTERN_CHUNK_SIZE 4096
+// The number of distinct chunks that duplicated chunks are drawn from.
+#define DATA_PATTERN_DEDUPE_CHUNKS 64
+
+#define DATA_GENERATOR_LANES 4
+
+// Generator of random data, consisting of several independent xorshift128+
+// generators that are advanced together, so that the compiler can vectorize
+// the generation. Every thread writing data has its own generator.
+
+class DataGenerator {
+private :
+	uint64_t s0[DATA_GENERATOR_LANES];
+	uint64_t s1[DATA_GENERATOR_LANES];
+	uint64_t decision_state;	// Used for the per-chunk decisions.
+public :
+	void Seed(uint64_t seed);
+	// Fill n 64-bit words with random data.
+	void Generate(uint64_t *p, size_t n);
+	// Fill size bytes with random data.
+	void GenerateBytes(char *buffer, size_t size);
+	// Return a uniformly distributed value in [0, 1).
+	double NextDouble();
+};
+
+class DataPattern {
+public :
+	int type;
+	int fixed_value;		// The byte value of DATA_PATTERN_FIXED.
+	double compressibility;		// Percentage of every chunk of random data that is zero.
+	double dedupe;			// Percentage of chunks of random data that are duplicates.
+
+	DataPattern();
+	bool IsRandom() const {
+		return type == DATA_PATTERN_RANDOM;
+	}
+	// Fill a buffer with the pattern. For the random pattern, new data is
+	// generated on every call.
+	void Fill(char *buffer, size_t size, DataGenerator *g) const;
+	// Return a description such as "random, 50% compressible".
+	const char *GetDescription(char *s) const;
+};
+
+// Parse a data pattern specification (ramp, zeros, random or fixed:VALUE).
+// Returns false if it is invalid.
+
+bool ParseDataPattern(const char *spec, DataPattern *pattern);
@@ -72,7 +72,7 @@ class CastDynamicArray : public C2 {
 public :
 	CastDynamicArray(int starting_capacity = 4) { }
 	inline T1 Get(int i) const {
-		return (T1)((C2 *)this->Get(i));
+		return (T1)((const C2 *)this)->Get(i);
 	}
 	inline void Add(T1 s) {
 		((C2 *)this)->Add((T2)s);
@@ -24,31 +24,80 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
-#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <getopt.h>
+#include <time.h>
 #include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
 
+#include "flash-bench.h"
 #include "cpu-stat.h"
 #include "dynamic-array.h"
 #include "timer.h"
+#include "latency-histogram.h"
+#include "buffer-pool.h"
+#include "io-engine.h"
+#include "random-permutation.h"
+#include "random-distribution.h"
+#include "data-pattern.h"
+#include "verify.h"
+#include "result-output.h"
+#include "trace-file.h"
+#include "trace-stats.h"
 
 static const struct option long_options[] = {
 	// Option name, argument flag, NULL, equivalent short option character.
 	{ "block-device", required_argument, NULL, 'b' },
+	{ "block-size", required_argument, NULL, 'k' },
+	{ "block-size-sweep", required_argument, NULL, 'w' },
+	{ "cache-mode", required_argument, NULL, 'K' },
+	{ "compressibility", required_argument, NULL, 'O' },
+	{ "data-pattern", required_argument, NULL, 'E' },
+	{ "dedupe", required_argument, NULL, 'X' },
 	{ "direct", no_argument, NULL, 'i' },
 	{ "duration", required_argument, NULL, 'd' },
+	{ "engine", required_argument, NULL, 'e' },
+	{ "fallocate", no_argument, NULL, 'A' },
 	{ "file", required_argument, NULL, 'f' },
+	{ "fill-direct", no_argument, NULL, 'I' },
+	{ "fill-threads", required_argument, NULL, 'F' },
 	{ "help", no_argument, NULL, 'h' },
+	{ "hot-cold", required_argument, NULL, 'H' },
+	{ "huge-pages", no_argument, NULL, 'U' },
+	{ "iodepth", required_argument, NULL, 'q' },
+	{ "iodepth-sweep", required_argument, NULL, 'p' },
+	{ "mlock", no_argument, NULL, 'L' },
 	{ "no-duration", no_argument, NULL, 'n' },
+	{ "normal-stddev", required_argument, NULL, 'N' },
+	{ "output-file", required_argument, NULL, 'l' },
+	{ "output-format", required_argument, NULL, 'm' },
+	{ "pareto-shape", required_argument, NULL, 'P' },
 	{ "random-seed", required_argument, NULL, 'o' },
+	{ "rate", required_argument, NULL, 'g' },
+	{ "rate-sweep", required_argument, NULL, 'G' },
 	{ "range", required_argument, NULL, 'r' },
+	{ "report-interval", required_argument, NULL, 'a' },
+	{ "rwmix-read", required_argument, NULL, 'x' },
 	{ "size", required_argument, NULL, 's' },
 	{ "sync", no_argument, NULL, 'y' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "threads-sweep", required_argument, NULL, 'j' },
 	{ "trace-direct", no_argument, NULL, 'v' },
+	{ "tsc", no_argument, NULL, 'c' },
+	{ "verify", no_argument, NULL, 'V' },
+	{ "trace-cache", no_argument, NULL, 'C' },
+	{ "trace-dispatch", required_argument, NULL, 'D' },
 	{ "trace-duration", required_argument, NULL, 'u' },
+	{ "trace-speed", required_argument, NULL, 'T' },
+	{ "trace-stats", no_argument, NULL, 'S' },
+	{ "zipf-theta", required_argument, NULL, 'z' },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -59,7 +108,8 @@ enum { CMD_READ = 0, CMD_WRITE = 1, CMD_SEQUENTIAL = 0, CMD_RANDOM = 2,
 	CMD_WRITE_SEQUENTIAL = CMD_WRITE | CMD_SEQUENTIAL,
 	CMD_READ_RANDOM = CMD_READ | CMD_RANDOM,
 	CMD_WRITE_RANDOM = CMD_WRITE | CMD_RANDOM,
-	CMD_TRACE = 4
+	CMD_TRACE = 4,
+	CMD_MIXED = 8	// Reads and writes in the ratio set with --rwmix-read.
 };
 
 class Test {
@@ -68,22 +118,41 @@ public :
 	const char *name;
 	const char *description;
 	char command_flags;
+	char distribution;	// Distribution of block indices of random access tests.
 };
 
 static const Test test[] = {
-	{ 'r', "seqrd", "Sequential read", CMD_READ | CMD_SEQUENTIAL },
-	{ 'w', "seqwr", "Sequential write", CMD_WRITE | CMD_SEQUENTIAL },
-	{ 'R', "rndrd", "Random read", CMD_READ | CMD_RANDOM },
-	{ 'W', "rndwr", "Random write", CMD_WRITE | CMD_RANDOM },
-	{ ' ', "trace", "Trace", CMD_TRACE }
+	{ 'r', "seqrd", "Sequential read", CMD_READ | CMD_SEQUENTIAL, DISTRIBUTION_UNIFORM },
+	{ 'w', "seqwr", "Sequential write", CMD_WRITE | CMD_SEQUENTIAL, DISTRIBUTION_UNIFORM },
+	{ 'R', "rndrd", "Random read", CMD_READ | CMD_RANDOM, DISTRIBUTION_UNIFORM },
+	{ 'W', "rndwr", "Random write", CMD_WRITE | CMD_RANDOM, DISTRIBUTION_UNIFORM },
+	{ 'm', "seqmix", "Sequential mixed read/write", CMD_MIXED | CMD_SEQUENTIAL,
+		DISTRIBUTION_UNIFORM },
+	{ 'M', "rndmix", "Random mixed read/write", CMD_MIXED | CMD_RANDOM, DISTRIBUTION_UNIFORM },
+	{ 'z', "zipfrd", "Zipf random read", CMD_READ | CMD_RANDOM, DISTRIBUTION_ZIPF },
+	{ 'Z', "zipfwr", "Zipf random write", CMD_WRITE | CMD_RANDOM, DISTRIBUTION_ZIPF },
+	{ 'p', "parrd", "Pareto random read", CMD_READ | CMD_RANDOM, DISTRIBUTION_PARETO },
+	{ 'P', "parwr", "Pareto random write", CMD_WRITE | CMD_RANDOM, DISTRIBUTION_PARETO },
+	{ 'n', "normrd", "Normal random read", CMD_READ | CMD_RANDOM, DISTRIBUTION_NORMAL },
+	{ 'N', "normwr", "Normal random write", CMD_WRITE | CMD_RANDOM, DISTRIBUTION_NORMAL },
+	{ 'h', "hotrd", "Hot/cold random read", CMD_READ | CMD_RANDOM, DISTRIBUTION_HOT_COLD },
+	{ 'H', "hotwr", "Hot/cold random write", CMD_WRITE | CMD_RANDOM, DISTRIBUTION_HOT_COLD },
+	{ ' ', "trace", "Trace", CMD_TRACE, DISTRIBUTION_UNIFORM }
 };
 
 #define NU_TESTS (sizeof(test) / sizeof(test[0]))
 #define NU_STANDARD_TESTS (NU_TESTS - 1)
+// The tests performed when none are specified.
+#define NU_DEFAULT_TESTS 4
 
 static const char *default_test_filename = "flash-bench.tmp";
 
 #define DEFAULT_TEST_FILE_RANGE (512 * 1024 * 1024)
+#define DEFAULT_BLOCK_SIZE 4096
+#define MIN_BLOCK_SIZE 512
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
+// The size of the writes used to fill a newly created test file.
+#define FILL_BLOCK_SIZE (4 * 1024 * 1024)
 
 enum {
 	FLAG_BLOCK_DEVICE = 0x1,
@@ -95,34 +164,143 @@ enum {
 	FLAG_TEST_FILE_RANGE = 0x40,
 	FLAG_TOTAL_TRANSACTION_SIZE = 0x80,
 	FLAG_ACCESS_MODE_SYNC = 0x100,
-	FLAG_TRACE_ACCESS_MODE_DIRECT = 0x200
+	FLAG_TRACE_ACCESS_MODE_DIRECT = 0x200,
+	FLAG_TSC_TIME_STAMPS = 0x400,
+	FLAG_TRACE_CACHE = 0x800,
+	FLAG_TRACE_STATS = 0x1000,
+	FLAG_FALLOCATE = 0x2000,
+	FLAG_FILL_DIRECT = 0x4000,
+	FLAG_HUGE_PAGES = 0x8000,
+	FLAG_MLOCK = 0x10000,
+	FLAG_VERIFY = 0x20000,
+	FLAG_DATA_PATTERN = 0x40000	// A data pattern was specified explicitly.
 };
 
 static int operating_flags;
 
 enum { VALUE_TYPE_SIZE, VALUE_TYPE_DURATION, VALUE_TYPE_GENERIC };
 
+// How the page cache is emptied before each test and written data is flushed
+// after it.
+enum {
+	CACHE_MODE_GLOBAL = 0,	// sync() and /proc/sys/vm/drop_caches (requires root).
+	CACHE_MODE_FILE = 1,	// fdatasync() and POSIX_FADV_DONTNEED on the test file.
+	CACHE_MODE_NONE = 2	// Leave the page cache alone.
+};
+
 static int length_type;
 static const char *test_filename;
 static int64_t test_file_range;
 static int64_t total_transaction_size;
-static int nu_blocks;	// The maximum total number of 4K block transactions per test.
+static int64_t nu_blocks;	// The maximum total number of block transactions per test.
+static int block_size;
+static int default_block_size;
 static uint32_t duration;
 static uint32_t trace_duration;
+static double trace_speed;		// Speed-up of timed trace replay, 0 for no timing.
+static int trace_dispatch;
+static int cache_mode;
 static uint32_t random_seed;
 static int extra_mode_access_flags;
 static int extra_mode_access_flags_trace;
-
-static char *buffer;
-static int *indices;
-
-class Trace {
+static int io_engine_type;
+static int output_format;
+static const char *output_filename;
+static FILE *message_stream = stdout;
+static int io_depth;
+static int default_io_depth;
+static int nu_threads;
+static int default_nu_threads;
+static int fill_threads;		// Number of threads used to create the test file.
+static uint32_t report_interval;	// In seconds, 0 when intervals are not reported.
+static double rwmix_read;		// Percentage of reads of the mixed tests.
+static int rate;			// Target rate of open-loop tests, 0 for closed-loop tests.
+static int default_rate;
+static bool rate_in_bytes;		// Whether rates are in KB/s instead of IOPS.
+static double zipf_theta;
+static double pareto_shape;
+static double normal_stddev;		// Percentage of the range.
+static double hot_access_percentage;
+static double hot_range_percentage;
+static DataPattern data_pattern;	// The data written to the test file.
+
+static RandomPermutation random_order;	// Block order of random access tests.
+// Distributions of the skewed random access tests over the whole test file
+// range, and the permutation that scatters popularity ranks over the range.
+static AccessDistribution access_distribution[NU_DISTRIBUTIONS];
+static RandomPermutation rank_order;
+
+// Worker threads. Each worker has its own I/O engine (and thus its own file
+// descriptor) and buffers, and performs a contiguous share of the block
+// transactions of each test. The workers persist for the whole run, so that
+// their CPU usage can be measured per test.
+
+class Worker {
 public :
-	uint8_t *data;
-	uint64_t size;
+	int index;
+	int tid;		// Kernel thread ID, used to look up CPU usage.
+	pthread_t thread;
+	IOEngine *engine;
+	BufferPool buffers;	// A buffer for every queue slot of the engine.
+	// Per buffer, whether it may no longer hold the data pattern because it
+	// has been used for a read.
+	bool *buffer_overwritten;
+	int64_t first_block;	// Range of transaction indices assigned to the worker.
+	int64_t nu_blocks;
+	RandomGenerator rng;	// Used by skewed random access tests.
+	DataGenerator data_generator;	// Used for random data patterns.
+	// Results of the last test.
+	int64_t bytes_processed;
+	double elapsed_time;
+	uint64_t verify_blocks;	// Results of the verification of the last test.
+	uint64_t verify_errors;
+	WriteOrderTracker write_order;	// Completion order of the writes of the last test.
+	// Interval reporting. The engine records into interval_stats[g & 1], where g
+	// is the last interval generation published by the worker, while the
+	// reporter thread reads the other one.
+	IntervalStatistics interval_stats[2];
+	int interval_generation;
+	bool finished;		// Set when the worker has finished the current test.
+	// Delay of timed trace records relative to their schedule.
+	LatencyHistogram replay_lag;
+	// Statistics of the trace streams replayed by the worker, indexed by stream
+	// (NULL when there are no traces).
+	TraceStreamStatistics *stream_stats;
+	uint64_t trace_position;	// Index of the next record of the current trace.
 };
 
+static Worker *workers;
+static pthread_barrier_t start_barrier;
+static pthread_barrier_t finish_barrier;
+// The test that the workers should perform next (- 1 to exit), set by the main
+// thread before the start barrier.
+static int current_command;
+static Trace *current_trace;
+static uint64_t current_trace_start_time;	// Time stamp of the start of a trace replay.
+static ThreadedTimeout *current_tt;
+static bool current_verify;		// Whether the workers verify the last test.
+// Identifies the blocks written by the current test with --verify: the upper
+// bits are unique for the run, the lower bits number the tests.
+static uint64_t verify_generation;
+static int verify_errors_reported;
+static uint64_t verify_errors_total;
+
+// Interval reporting (--report-interval). At the end of every interval, the
+// reporter thread increments interval_generation. Each worker notices this in
+// its transaction loop, swaps in fresh interval statistics for its engine and
+// publishes the new generation, after which the reporter can read the
+// statistics of the interval that has ended. No locks are taken.
+static int interval_generation;
+static bool interval_reporter_stop;
+static pthread_t interval_reporter_thread;
+static TestResult interval_result;
+static IntervalStatistics *interval_sum;	// Combined statistics of all workers.
+
 TightIntArray commands(4);
+TightIntArray sweep_block_sizes(4);
+TightIntArray sweep_io_depths(4);
+TightIntArray sweep_nu_threads(4);
+TightIntArray sweep_rates(4);
 CharPointerArray trace_filenames(4);
 CastDynamicArray <Trace *, void *, PointerArray> traces(4);
 
@@ -134,10 +312,10 @@ static bool FlagIsSet(int flag) {
 	return (operating_flags & flag) != 0;
 }
 
-static void Message(const char *format, ...) {
+void Message(const char *format, ...) {
     va_list args;
     va_start(args, format);
-    vprintf(format, args);
+    vfprintf(message_stream, format, args);
     va_end(args);
 }
 
@@ -145,6 +323,19 @@ static int RoundToMB(int64_t nu_bytes) {
 	return (nu_bytes + 512 * 1024 - 1) >> 20;
 }
 
+// Format a size in bytes using the largest unit that represents it exactly,
+// for example 512B, 4K or 2M.
+
+static const char *FormatSize(int64_t size, char *s) {
+	if (size >= 1024 * 1024 && (size & (1024 * 1024 - 1)) == 0)
+		sprintf(s, "%dM", (int)(size >> 20));
+	else if (size >= 1024 && (size & 1023) == 0)
+		sprintf(s, "%dK", (int)(size >> 10));
+	else
+		sprintf(s, "%dB", (int)size);
+	return s;
+}
+
 static void Usage() {
 	Message("flash-bench v%d.%d\n", VERSION_MAJOR, VERSION_MINOR);
 	Message("Usage: flash-bench [OPTIONS] [TESTNAME]|[TESTSHORTHAND] [TESTNAME]...\n\n");
@@ -167,6 +358,11 @@ static void Usage() {
 		Message("      %-3c  %-16s  %s\n", test[i].command_ch, test[i].name, test[i].description);
 	Message("           trace=[FILENAME]  Replay a trace file\n");
 
+	Message("\nAvailable I/O engines (--engine):\n    ");
+	for (int i = 0; i < NU_IO_ENGINES; i++)
+		Message("%s%s", GetIOEngineName(i), i == DEFAULT_IO_ENGINE ? " (default)  " : "  ");
+	Message("\n");
+
 	Message(" \nExample: flash-bench\n"
 		"    Run all tests (sequential read and write, random read and write)\n"
 		"    using a default range/size of 512MB, creating a test file of size\n"
@@ -185,11 +381,11 @@ static void Usage() {
 		RoundToMB(DEFAULT_TEST_FILE_RANGE));
 }
 
-static void __attribute__((noreturn)) FatalError(const char *format, ...) {
+void __attribute__((noreturn)) FatalError(const char *format, ...) {
 	va_list args;
 	va_start(args, format);
-	vprintf(format, args);
-	fflush(stdout);
+	vfprintf(message_stream, format, args);
+	fflush(message_stream);
 	va_end(args);
 	exit(1);
 }
@@ -202,10 +398,11 @@ static int64_t ParseValue(char *arg, int *type) {
 		no_unit = true;
 	else
 		no_unit = false;
-	if (unit != 'K' && unit != 'M' && unit != 'G' && unit != 's' && unit != 'm')
-		FatalError("Expected unit K, M, G (transaction size) or s or m (duration) "
+	if (!no_unit && unit != 'K' && unit != 'M' && unit != 'G' && unit != 'T' && unit != 's' &&
+	unit != 'm')
+		FatalError("Expected unit K, M, G, T (transaction size) or s or m (duration) "
 			"for length argument.\n");
-	if (length < 2)
+	if (!no_unit && length < 2)
 		FatalError("Size expected before unit for length argument.\n");
 	if (no_unit && length < 1)
 		FatalError("No value specified.\n");
@@ -225,6 +422,7 @@ static int64_t ParseValue(char *arg, int *type) {
 	case 'K' : size *= 1024; break;
 	case 'M' : size *= 1024 * 1024; break;
 	case 'G' : size *= 1024 * 1024 * 1024; break;
+	case 'T' : size *= (int64_t)1024 * 1024 * 1024 * 1024; break;
 	case 'm' : size *= 60;
 	case 's' : t = VALUE_TYPE_DURATION; break;
 	}
@@ -232,16 +430,116 @@ static int64_t ParseValue(char *arg, int *type) {
 	return size;
 }
 
+static int ParseBlockSize(char *arg) {
+	int value_type;
+	int64_t size = ParseValue(arg, &value_type);
+	if (value_type == VALUE_TYPE_DURATION || size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE ||
+	(size % MIN_BLOCK_SIZE) != 0)
+		FatalError("Invalid block size %s (must be a multiple of 512 bytes from 512 to 64M).\n",
+			arg);
+	return size;
+}
+
+static int ParseIODepth(char *arg) {
+	int value_type;
+	int64_t depth = ParseValue(arg, &value_type);
+	if (value_type != VALUE_TYPE_GENERIC || depth > 4096)
+		FatalError("Invalid I/O depth (expected a number from 1 to 4096).\n");
+	return depth;
+}
+
+static int ParseNumberOfThreads(char *arg) {
+	int value_type;
+	int64_t n = ParseValue(arg, &value_type);
+	if (value_type != VALUE_TYPE_GENERIC || n > 1024)
+		FatalError("Invalid number of threads (expected a number from 1 to 1024).\n");
+	return n;
+}
+
+// Parse a target rate, which is either a number of transactions per second or
+// a size per second (for example 100M), and return it in IOPS or KB/s
+// respectively. All rates must be of the same kind.
+
+static int ParseRate(char *arg) {
+	static int rate_kind = - 1;
+	int value_type;
+	int64_t value = ParseValue(arg, &value_type);
+	if (value_type == VALUE_TYPE_DURATION || (value_type == VALUE_TYPE_SIZE && value < 1024))
+		FatalError("Invalid rate %s (expected IOPS or a size per second of at least 1K).\n",
+			arg);
+	if (rate_kind >= 0 && rate_kind != value_type)
+		FatalError("Rates must either all be in IOPS or all be sizes per second.\n");
+	rate_kind = value_type;
+	rate_in_bytes = (value_type == VALUE_TYPE_SIZE);
+	if (rate_in_bytes)
+		value /= 1024;
+	if (value > INT_MAX)
+		FatalError("Invalid rate %s (too large).\n", arg);
+	return value;
+}
+
+// Parse a real number option value in the range [min_value, max_value].
+
+static double ParseReal(const char *arg, double min_value, double max_value, const char *name) {
+	char *end;
+	double value = strtod(arg, &end);
+	if (end == arg || *end != '\0' || !(value >= min_value && value <= max_value))
+		FatalError("Invalid %s %s (expected a number from %g to %g).\n", name, arg,
+			min_value, max_value);
+	return value;
+}
+
+// Parse a comma-separated list of sweep values. An element of the form MIN-MAX
+// denotes all powers of two from MIN to MAX.
+
+static void ParseSweepList(const char *arg, TightIntArray *values, int (*parse)(char *)) {
+	char *list = strdup(arg);
+	char *saveptr;
+	for (char *element = strtok_r(list, ",", &saveptr); element != NULL;
+	element = strtok_r(NULL, ",", &saveptr)) {
+		char *dash = strchr(element, '-');
+		if (dash == NULL) {
+			values->Add(parse(element));
+			continue;
+		}
+		*dash = '\0';
+		int min_value = parse(element);
+		int max_value = parse(dash + 1);
+		for (int64_t value = min_value; value <= max_value; value *= 2)
+			values->Add(value);
+	}
+	free(list);
+	if (values->Size() == 0)
+		FatalError("No values specified for sweep.\n");
+}
+
 static void ParseOptions(int argc, char **argv) {
 	operating_flags = 0;
 	duration = 60;
 	test_filename = default_test_filename;
+	io_engine_type = DEFAULT_IO_ENGINE;
+	output_format = OUTPUT_FORMAT_TEXT;
+	output_filename = NULL;
+	default_io_depth = 1;
+	default_nu_threads = 1;
+	fill_threads = 1;
+	default_block_size = DEFAULT_BLOCK_SIZE;
+	rwmix_read = 50.0;
+	default_rate = 0;
+	zipf_theta = 0.99;
+	pareto_shape = 1.161;	// 80% of the accesses to 20% of the blocks.
+	normal_stddev = 10.0;
+	hot_access_percentage = 90.0;
+	hot_range_percentage = 10.0;
+	trace_speed = 1.0;
+	trace_dispatch = TRACE_DISPATCH_STREAM;
+	cache_mode = CACHE_MODE_GLOBAL;
 	int value_type;
 	
 	while (true) {
 		int this_option_optind = optind ? optind : 1;
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "b:id:f:hno:r:s:yvu:", long_options, &option_index);
+		int c = getopt_long(argc, argv, "b:k:w:K:O:E:X:id:e:Af:IF:hH:Uq:p:LnN:l:m:P:o:g:G:r:a:x:s:yt:j:vcVCD:u:T:Sz:", long_options, &option_index);
 		if (c == -1)
 			break;
 
@@ -250,21 +548,100 @@ static void ParseOptions(int argc, char **argv) {
 			SetFlag(FLAG_BLOCK_DEVICE);
 			test_filename = strdup(optarg);
 			break;
+		case 'k' :	// -k, --block-size
+			default_block_size = ParseBlockSize(optarg);
+			break;
+		case 'w' :	// -w, --block-size-sweep
+			ParseSweepList(optarg, &sweep_block_sizes, ParseBlockSize);
+			break;
+		case 'K' :	// -K, --cache-mode
+			if (strcmp(optarg, "global") == 0)
+				cache_mode = CACHE_MODE_GLOBAL;
+			else if (strcmp(optarg, "file") == 0)
+				cache_mode = CACHE_MODE_FILE;
+			else if (strcmp(optarg, "none") == 0)
+				cache_mode = CACHE_MODE_NONE;
+			else
+				FatalError("Unknown cache mode %s (expected global, file or none).\n",
+					optarg);
+			break;
+		case 'O' :	// -O, --compressibility
+			data_pattern.compressibility = ParseReal(optarg, 0, 100, "compressibility");
+			break;
+		case 'E' :	// -E, --data-pattern
+			if (!ParseDataPattern(optarg, &data_pattern))
+				FatalError("Invalid data pattern %s (expected ramp, zeros, random or "
+					"fixed:VALUE).\n", optarg);
+			SetFlag(FLAG_DATA_PATTERN);
+			break;
+		case 'X' :	// -X, --dedupe
+			data_pattern.dedupe = ParseReal(optarg, 0, 100, "dedupe percentage");
+			break;
 		case 'i' :	// -i. --direct
 			SetFlag(FLAG_ACCESS_MODE_DIRECT);
 			break;
 		case 'd' :	// -d, --duration
 			duration = ParseValue(optarg, &value_type);
 			break;
+		case 'e' :	// -e, --engine
+			io_engine_type = LookupIOEngine(optarg);
+			if (io_engine_type < 0)
+				FatalError("Unknown I/O engine %s.\n", optarg);
+			break;
+		case 'A' :	// -A, --fallocate
+			SetFlag(FLAG_FALLOCATE);
+			break;
 		case 'f' :	// -f, --file
 			test_filename = strdup(optarg);
 			break;
+		case 'I' :	// -I, --fill-direct
+			SetFlag(FLAG_FILL_DIRECT);
+			break;
+		case 'F' :	// -F, --fill-threads
+			fill_threads = ParseNumberOfThreads(optarg);
+			break;
 		case 'h' :	// -h, --help
 			Usage();
 			exit(0);
+		case 'H' : {	// -H, --hot-cold
+			char *colon = strchr(optarg, ':');
+			if (colon == NULL)
+				FatalError("Invalid hot/cold specification %s (expected ACCESS:RANGE, for "
+					"example 90:10).\n", optarg);
+			*colon = '\0';
+			hot_access_percentage = ParseReal(optarg, 0, 100, "hot access percentage");
+			hot_range_percentage = ParseReal(colon + 1, 0, 100, "hot range percentage");
+			break;
+			}
+		case 'U' :	// -U, --huge-pages
+			SetFlag(FLAG_HUGE_PAGES);
+			break;
+		case 'q' :	// -q, --iodepth
+			default_io_depth = ParseIODepth(optarg);
+			break;
+		case 'p' :	// -p, --iodepth-sweep
+			ParseSweepList(optarg, &sweep_io_depths, ParseIODepth);
+			break;
+		case 'L' :	// -L, --mlock
+			SetFlag(FLAG_MLOCK);
+			break;
 		case 'n' :	// -n, --no-duration
 			SetFlag(FLAG_NO_DURATION);
 			break;
+		case 'N' :	// -N, --normal-stddev
+			normal_stddev = ParseReal(optarg, 0.001, 1000, "standard deviation");
+			break;
+		case 'l' :	// -l, --output-file
+			output_filename = strdup(optarg);
+			break;
+		case 'm' :	// -m, --output-format
+			output_format = LookupOutputFormat(optarg);
+			if (output_format < 0)
+				FatalError("Unknown output format %s (expected text, json or csv).\n", optarg);
+			break;
+		case 'P' :	// -P, --pareto-shape
+			pareto_shape = ParseReal(optarg, 1.001, 100, "Pareto shape");
+			break;
 		case 'o' :	// -o, --random-seed
 			if (strcmp(optarg, "time") == 0) {
 				SetFlag(FLAG_RANDOM_SEED_TIME);
@@ -274,10 +651,24 @@ static void ParseOptions(int argc, char **argv) {
 				random_seed = ParseValue(optarg, &value_type);
 			}
 			break;
+		case 'g' :	// -g, --rate
+			default_rate = ParseRate(optarg);
+			break;
+		case 'G' :	// -G, --rate-sweep
+			ParseSweepList(optarg, &sweep_rates, ParseRate);
+			break;
 		case 'r' :	// -r, --range
 			SetFlag(FLAG_TEST_FILE_RANGE);
 			test_file_range = ParseValue(optarg, &value_type);
 			break;
+		case 'a' :	// -a, --report-interval
+			report_interval = ParseValue(optarg, &value_type);
+			if (value_type != VALUE_TYPE_DURATION)
+				FatalError("Invalid report interval (expected a duration such as 1s).\n");
+			break;
+		case 'x' :	// -x, --rwmix-read
+			rwmix_read = ParseReal(optarg, 0, 100, "read percentage");
+			break;
 		case 's' :	// -s, --size
 			SetFlag(FLAG_TOTAL_TRANSACTION_SIZE);
 			total_transaction_size = ParseValue(optarg, &value_type);
@@ -285,13 +676,48 @@ static void ParseOptions(int argc, char **argv) {
 		case 'y' :	// -y, --sync
 			SetFlag(FLAG_ACCESS_MODE_SYNC);
 			break;
+		case 't' :	// -t, --threads
+			default_nu_threads = ParseNumberOfThreads(optarg);
+			break;
+		case 'j' :	// -j, --threads-sweep
+			ParseSweepList(optarg, &sweep_nu_threads, ParseNumberOfThreads);
+			break;
 		case 'v' :	// -v, --trace-direct
 			SetFlag(FLAG_TRACE_ACCESS_MODE_DIRECT);
 			break;
+		case 'c' :	// -c, --tsc
+			SetFlag(FLAG_TSC_TIME_STAMPS);
+			break;
+		case 'V' :	// -V, --verify
+			SetFlag(FLAG_VERIFY);
+			break;
+		case 'C' :	// -C, --trace-cache
+			SetFlag(FLAG_TRACE_CACHE);
+			break;
+		case 'D' :	// -D, --trace-dispatch
+			if (strcmp(optarg, "stream") == 0)
+				trace_dispatch = TRACE_DISPATCH_STREAM;
+			else if (strcmp(optarg, "round-robin") == 0)
+				trace_dispatch = TRACE_DISPATCH_ROUND_ROBIN;
+			else
+				FatalError("Unknown trace dispatch mode %s.\n", optarg);
+			break;
 		case 'u' :	// -u, --trace-duration
 			SetFlag(FLAG_TRACE_DURATION);
 			trace_duration = ParseValue(optarg, &value_type);
 			break;
+		case 'T' :	// -T, --trace-speed
+			if (strcmp(optarg, "max") == 0)
+				trace_speed = 0;
+			else
+				trace_speed = ParseReal(optarg, 0.001, 1000000, "trace speed");
+			break;
+		case 'S' :	// -S, --trace-stats
+			SetFlag(FLAG_TRACE_STATS);
+			break;
+		case 'z' :	// -z, --zipf-theta
+			zipf_theta = ParseReal(optarg, 0.001, 100, "Zipf theta");
+			break;
 		default :
 			FatalError("");
 			break;
@@ -300,10 +726,10 @@ static void ParseOptions(int argc, char **argv) {
 
 	if (optind < argc) {
 		for (int i = optind; i < argc; i++) {
-			if (strcmp(argv[i], "trace=") == 0) {
+			if (strncmp(argv[i], "trace=", 6) == 0) {
 				trace_filenames.Add(strdup(&argv[i][6]));
-				commands.Add(CMD_TRACE);
-				break;
+				commands.Add(NU_STANDARD_TESTS);
+				continue;
 			}
 			int t = - 1;
 			for (int j = 0; j < NU_STANDARD_TESTS; j++)
@@ -334,94 +760,252 @@ static void ParseOptions(int argc, char **argv) {
 		}
 	}
 
+	// Compressibility and dedupe imply the random data pattern, unless another
+	// one was given.
+	if (data_pattern.compressibility > 0 || data_pattern.dedupe > 0) {
+		if (!FlagIsSet(FLAG_DATA_PATTERN))
+			data_pattern.type = DATA_PATTERN_RANDOM;
+		else if (!data_pattern.IsRandom())
+			FatalError("Compressibility and dedupe only apply to the random data pattern.\n");
+	}
+
 	if (commands.Size() == 0) {
-		// No test names or traces specified. Perform all standard tests.
-		for (int i = 0; i < NU_STANDARD_TESTS; i++)
+		// No test names or traces specified. Perform the sequential and
+		// uniform random access tests.
+		for (int i = 0; i < NU_DEFAULT_TESTS; i++)
 			commands.Add(i);
 	}
 }
 
-static void CreateBuffer() {
-	buffer = new char[4096];
-	for (int i = 0; i < 4096; i++) {
-		buffer[i] = i & 0xFF;
-	}
+// Allocate the buffers of a pool and fill them with the data pattern written
+// to the test file.
+
+static void CreateBuffers(BufferPool *pool, int nu_buffers, int size, DataGenerator *g) {
+	int flags = 0;
+	if (FlagIsSet(FLAG_HUGE_PAGES))
+		flags |= BUFFER_POOL_HUGE_PAGES;
+	if (FlagIsSet(FLAG_MLOCK))
+		flags |= BUFFER_POOL_LOCK;
+	pool->Allocate(nu_buffers, size, flags);
+	for (int i = 0; i < nu_buffers; i++)
+		data_pattern.Fill(pool->Get(i), size, g);
 }
 
-static void CreateIndices() {
-	indices = new int[nu_blocks];
-}
+static const char char_three = '3';
 
-static void SetRandomIndices() {
-	for (int i = 0; i < nu_blocks; i++)
-		indices[i] = i;
-	// Traverse the array from start to end and swap indices randomly.
-	for (int i = 0; i < nu_blocks; i++) {
-		int j = rand() % nu_blocks;
-		int index_i = indices[i];
-		indices[i] = indices[j];
-		indices[j] = index_i;
-	}
+static void DropGlobalCaches() {
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_SYNC);
+	int r = write(fd, &char_three, 1);
+	close(fd);
+	if (r != 1)
+		Message("Warning: Cache flushing unsuccesful. Permission problem?\n"
+			"flash-bench should be run as superuser for best effects, or use "
+			"--cache-mode=file.\n");
 }
 
-static void DestroyBuffer() {
-	delete [] buffer;
+#define MINCORE_CHUNK_SIZE ((uint64_t)1 << 30)
+
+// Return the number of pages of the given range of a file that are present in
+// the page cache, or - 1 when this cannot be determined.
+
+static int64_t CountCachedPages(int fd, uint64_t size) {
+	static unsigned char *vec = NULL;
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (vec == NULL)
+		vec = new unsigned char[MINCORE_CHUNK_SIZE / page_size];
+	int64_t count = 0;
+	for (uint64_t offset = 0; offset < size; offset += MINCORE_CHUNK_SIZE) {
+		uint64_t length = size - offset;
+		if (length > MINCORE_CHUNK_SIZE)
+			length = MINCORE_CHUNK_SIZE;
+		void *p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+		if (p == MAP_FAILED)
+			return - 1;
+		if (mincore(p, length, vec) != 0) {
+			munmap(p, length);
+			return - 1;
+		}
+		uint64_t nu_pages = (length + page_size - 1) / page_size;
+		for (uint64_t i = 0; i < nu_pages; i++)
+			count += vec[i] & 1;
+		munmap(p, length);
+	}
+	return count;
 }
 
-static const char *empty_environment[] = { NULL };
+// Write back and evict the pages of the test file only, leaving the rest of the
+// page cache intact. Pages that are mapped or locked by another process cannot
+// be evicted, so whether the range is really no longer cached is verified. This
+// is only possible when the test file is writable; otherwise the kernel
+// reports all pages as cached.
 
-static void ExecuteSync() {
-	// Create a child process
-	int child_pid = fork();
-	if (child_pid == 0)
-		execle("/bin/sync", "/bin/sync", (char *)NULL, empty_environment);
-	int status;
-	waitpid(child_pid, &status, 0);
+static void DropFileCache() {
+	int fd = open(test_filename, O_RDONLY);
+	if (fd < 0)
+		FatalError("Error - could not open test file %s.\n", test_filename);
+	bool verify = access(test_filename, W_OK) == 0;
+	int64_t cached_pages = 0;
+	for (int attempt = 0; attempt < 3; attempt++) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		if (!verify)
+			break;
+		cached_pages = CountCachedPages(fd, test_file_range);
+		if (cached_pages <= 0)
+			break;
+	}
+	if (cached_pages < 0)
+		Message("Warning: Could not determine whether the test file range remains in the "
+			"page cache.\n");
+	else if (cached_pages > 0)
+		Message("Warning: %dMB of the test file range remains in the page cache.\n",
+			RoundToMB(cached_pages * sysconf(_SC_PAGESIZE)));
+	close(fd);
 }
 
-static const char char_three = '3';
-
 static void DropCaches() {
-	ExecuteSync();
-	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_SYNC);
-	int r = write(fd, &char_three, 1);
-	close(fd);
-	if (r != 1)
-		Message("Warning: Cache flushing unsuccesful. Permission problem?\n"
-			"flash-bench should be run as superuser for best effects.\n");
+	if (cache_mode == CACHE_MODE_GLOBAL)
+		DropGlobalCaches();
+	else if (cache_mode == CACHE_MODE_FILE)
+		DropFileCache();
 }
 
+// Flush the data written during a test to the device. This is part of the
+// measured time of a test.
+
 static void Sync() {
-	ExecuteSync();
+	if (cache_mode == CACHE_MODE_GLOBAL)
+		sync();
+	else if (cache_mode == CACHE_MODE_FILE) {
+		int fd = open(test_filename, O_RDONLY);
+		if (fd >= 0) {
+			fdatasync(fd);
+			close(fd);
+		}
+	}
 }
 
 // File I/O wrappers.
 
-static void CheckFDError(int fd) {
-	if (fd < 0)
-		FatalError("Error opening file.\n");
+static void pwrite_with_check(int fd, void *buffer, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t size_written = pwrite(fd, buffer, size, offset);
+		if (size_written <= 0)
+			FatalError("Error during write operation.\n");
+		buffer = (char *)buffer + size_written;
+		size -= size_written;
+		offset += size_written;
+	}
 }
 
-static void read_with_check(int fd, void *buffer, size_t size) {
-	ssize_t size_read = read(fd, buffer, size);
-	if (size_read != size)
-		FatalError("Error during read operation.\n");
-}
+// A thread filling a region of the test file while it is created.
 
-static void write_with_check(int fd, void *buffer, size_t size) {
-	ssize_t size_written = write(fd, buffer, size);
-	if (size_written != size)
-		FatalError("Error during write operation.\n");
+class FillThread {
+public :
+	pthread_t thread;
+	int fd;
+	char *buffer;
+	DataGenerator data_generator;
+	uint64_t start;
+	uint64_t end;
+	uint64_t bytes_written;	// Read by the main thread to report progress.
+};
+
+static void *FillThreadMain(void *p) {
+	FillThread *f = (FillThread *)p;
+	for (uint64_t offset = f->start; offset < f->end; offset += FILL_BLOCK_SIZE) {
+		uint64_t size = f->end - offset;
+		if (size > FILL_BLOCK_SIZE)
+			size = FILL_BLOCK_SIZE;
+		if (data_pattern.IsRandom())
+			data_pattern.Fill(f->buffer, size, &f->data_generator);
+		pwrite_with_check(f->fd, f->buffer, size, offset);
+		__atomic_store_n(&f->bytes_written, offset + size - f->start, __ATOMIC_RELAXED);
+	}
+	return NULL;
 }
 
+#define FILL_PROGRESS_INTERVAL 10
+
+// Create the test file, writing the whole range with large writes. Each fill
+// thread writes a contiguous region of the file. The time taken includes
+// flushing the data to the device, so that the reported bandwidth is that of
+// the device rather than of the page cache.
 
 static void CreateTestFile() {
-	int fd = open(test_filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+	int flags = O_WRONLY | O_CREAT;
+	if (FlagIsSet(FLAG_FILL_DIRECT))
+		flags |= O_DIRECT;
+	int fd = open(test_filename, flags, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0 && FlagIsSet(FLAG_FILL_DIRECT) && errno == EINVAL) {
+		Message("Warning: O_DIRECT not supported for test file, filling it without it.\n");
+		fd = open(test_filename, flags & ~O_DIRECT, S_IRUSR | S_IWUSR | S_IRGRP);
+	}
 	if (fd < 0)
 		FatalError("Error - could not create test file %s (permission problem?).\n",
 			test_filename);
-	for (int i = 0; i < (test_file_range + 4095) / 4096; i++)
-		write_with_check(fd, buffer, 4096);
+	// Keep the size a multiple of 4K so that O_DIRECT writes remain aligned.
+	uint64_t size = (test_file_range + 4095) & ~(uint64_t)4095;
+	if (FlagIsSet(FLAG_FALLOCATE)) {
+		int r = posix_fallocate(fd, 0, size);
+		if (r != 0)
+			Message("Warning: Pre-allocation of test file failed (%s).\n", strerror(r));
+	}
+	int n = fill_threads;
+	// Divide the file into regions that are a multiple of the fill block size.
+	uint64_t nu_fill_blocks = (size + FILL_BLOCK_SIZE - 1) / FILL_BLOCK_SIZE;
+	if (n > nu_fill_blocks)
+		n = nu_fill_blocks;
+	uint64_t region_size = (nu_fill_blocks + n - 1) / n * FILL_BLOCK_SIZE;
+	FillThread *fill = new FillThread[n];
+	for (int i = 0; i < n; i++)
+		fill[i].data_generator.Seed(((uint64_t)random_seed << 32) + 0x80000000 + i);
+	// With random data, every thread needs its own buffer.
+	BufferPool buffers;
+	CreateBuffers(&buffers, data_pattern.IsRandom() ? n : 1, FILL_BLOCK_SIZE,
+		&fill[0].data_generator);
+	double start_time = GetCurrentTime();
+	for (int i = 0; i < n; i++) {
+		FillThread *f = &fill[i];
+		f->fd = fd;
+		f->buffer = buffers.Get(data_pattern.IsRandom() ? i : 0);
+		f->start = i * region_size;
+		f->end = f->start + region_size;
+		if (f->start > size)
+			f->start = size;
+		if (f->end > size)
+			f->end = size;
+		f->bytes_written = 0;
+		if (pthread_create(&f->thread, NULL, FillThreadMain, f) != 0)
+			FatalError("Error creating thread.\n");
+	}
+	// Report progress while the threads are running.
+	double progress_time = start_time + FILL_PROGRESS_INTERVAL;
+	while (true) {
+		usleep(100000);
+		uint64_t bytes_written = 0;
+		for (int i = 0; i < n; i++)
+			bytes_written += __atomic_load_n(&fill[i].bytes_written, __ATOMIC_RELAXED);
+		if (bytes_written == size)
+			break;
+		double current_time = GetCurrentTime();
+		if (current_time >= progress_time) {
+			Message("Written %dMB of %dMB (%.1f MB/s).\n", RoundToMB(bytes_written),
+				RoundToMB(size), (double)bytes_written / (1024 * 1024) /
+				(current_time - start_time));
+			fflush(message_stream);
+			progress_time += FILL_PROGRESS_INTERVAL;
+		}
+	}
+	for (int i = 0; i < n; i++)
+		pthread_join(fill[i].thread, NULL);
+	if (fdatasync(fd) != 0)
+		FatalError("Error during synchronization of test file.\n");
+	double elapsed = GetCurrentTime() - start_time;
+	Message("Created test file in %.1fs (%.1f MB/s using %d thread%s).\n", elapsed,
+		(double)size / (1024 * 1024) / elapsed, n, n == 1 ? "" : "s");
+	delete [] fill;
 	close(fd);
 }
 
@@ -431,10 +1015,16 @@ static void CheckTestFile() {
 	struct stat sb;
 	int r = stat(test_filename, &sb);
 	if (FlagIsSet(FLAG_BLOCK_DEVICE)) {
-		if (!S_ISBLK(sb.st_mode))
+		if (r == - 1 || !S_ISBLK(sb.st_mode))
 			FatalError("Device file %s does not appear to be a block device.\n",
 				test_filename);
-		if (sb.st_size < test_file_range)
+		// The size of a block device is not reported by stat().
+		uint64_t device_size;
+		int fd = open(test_filename, O_RDONLY);
+		if (fd < 0 || ioctl(fd, BLKGETSIZE64, &device_size) < 0)
+			FatalError("Could not determine the size of block device %s.\n", test_filename);
+		close(fd);
+		if (device_size < test_file_range)
 			FatalError("Block device size is smaller than test file range.\n");
 		return;
 	}
@@ -470,217 +1060,1053 @@ static void CheckTestFile() {
 }
 
 static void PrepareTraces() {
-//	traces.Init();
 	for (int i = 0; i < trace_filenames.Size(); i++) {
 		char *filename = trace_filenames.Get(i);
-		struct stat sb;
-		int r = stat(filename, &sb);
-		// Load the trace data exactly as it is stored in the trace file.
-		Message("Loading trace file %s (%dMB).\n", RoundToMB(sb.st_size));
-		uint8_t *tracep = new uint8_t[sb.st_size];
-		FILE *f = fopen(filename, "rb");
-		if (f = NULL)
-			FatalError("Could not open trace file %s.\n", filename);
-		ssize_t size = fread(tracep, 1, sb.st_size, f);
-		if (size < sb.st_size)
-			FatalError("Error loading trace file %s.\n", filename);
-		fclose(f);
 		Trace *trace = new Trace;
-		trace->data = tracep;
-		trace->size = size;
+		trace->Open(filename, FlagIsSet(FLAG_TRACE_CACHE));
 		traces.Add(trace);
 	}
 }
 
-// Duration-limited tests.
+static void PublishInterval(Worker *w) {
+	int generation = __atomic_load_n(&interval_generation, __ATOMIC_ACQUIRE);
+	IntervalStatistics *s = &w->interval_stats[generation & 1];
+	s->Reset();
+	w->engine->SwapIntervalStatistics(s);
+	__atomic_store_n(&w->interval_generation, generation, __ATOMIC_RELEASE);
+}
 
-static int SequentialRead(ThreadedTimeout *tt) {
-	int fd = open(test_filename, O_RDONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	int blocks_processed = 0;
-	for (int i = 0; i < nu_blocks; i++) {
-		read_with_check(fd, buffer, 4096);
-		blocks_processed++;
-		if (tt->StopSignalled())
-			break;
+// Called by a worker for every transaction; only when a reporting interval has
+// ended is more than a single comparison required.
+
+static inline void CheckInterval(Worker *w) {
+	if (__atomic_load_n(&interval_generation, __ATOMIC_RELAXED) != w->interval_generation)
+		PublishInterval(w);
+}
+
+// Return the target rate of the current test in IOPS, or 0 for a closed-loop
+// test.
+
+static double GetTargetIOPS() {
+	if (rate_in_bytes)
+		return rate * 1024.0 / block_size;
+	return rate;
+}
+
+// Wait until the given time stamp has been reached. When there is a wait, it
+// ends a burst of transactions, so the transactions queued by the engine are
+// submitted first. Idle while the wait is long, and spin during the last part
+// for accuracy. Meanwhile, the engine reaps the completions of outstanding
+// transactions as they occur, so that their latency is not inflated by the
+// wait. Reporting intervals and the time-out (if any) are checked at least
+// every 100 ms; returns false if the time-out was signalled.
+
+static bool WaitForTimeStamp(Worker *w, uint64_t time_stamp, ThreadedTimeout *tt) {
+	if (GetTimeStamp() < time_stamp)
+		w->engine->Flush();
+	for (;;) {
+		uint64_t time = GetTimeStamp();
+		if (time >= time_stamp)
+			return true;
+		uint64_t remaining_nsec = TimeStampToNSec(time_stamp - time);
+		if (remaining_nsec > 200000) {
+			CheckInterval(w);
+			if (tt != NULL && tt->StopSignalled())
+				return false;
+			if (remaining_nsec > 100200000)
+				remaining_nsec = 100200000;
+			w->engine->Idle(remaining_nsec - 100000);
+		}
+		else
+			w->engine->Idle(0);
 	}
-	close(fd);
-	return blocks_processed;
 }
 
-static int SequentialWrite(ThreadedTimeout *tt) {
-	int fd = open(test_filename, O_WRONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	int blocks_processed = 0;
-	for (int i = 0; i < nu_blocks; i++) {
-		write_with_check(fd, buffer, 4096);
-		blocks_processed++;
-		if (tt->StopSignalled())
-			break;
+// Return the buffer for the next write transaction, filled with the data
+// pattern. For the random pattern, new data is generated for every write;
+// other patterns are only filled in again when the buffer has been used for a
+// read since it was last filled.
+
+static inline char *GetWriteBuffer(Worker *w, size_t size) {
+	char *buffer = w->engine->GetBuffer();
+	bool *overwritten = &w->buffer_overwritten[w->buffers.GetIndex(buffer)];
+	if (data_pattern.IsRandom() || *overwritten) {
+		data_pattern.Fill(buffer, size, &w->data_generator);
+		*overwritten = false;
 	}
-	close(fd);
-	return blocks_processed;
+	return buffer;
 }
 
-static int RandomRead(ThreadedTimeout *tt) {
-	int fd = open(test_filename, O_RDONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	int blocks_processed = 0;
-	for (int i = 0; i < nu_blocks; i++) {
-		int block_index = indices[i];
-		lseek(fd, block_index * 4096, SEEK_SET);
-		read_with_check(fd, buffer, 4096);
-		blocks_processed++;
-		if (tt->StopSignalled())
-			break;
+// Return the buffer for the next read transaction.
+
+static inline char *GetReadBuffer(Worker *w) {
+	char *buffer = w->engine->GetBuffer();
+	w->buffer_overwritten[w->buffers.GetIndex(buffer)] = true;
+	return buffer;
+}
+
+// Return the index of the block accessed by the transaction with index i of a
+// sequential or random access test. With a skewed distribution, the block is
+// drawn using the worker's random number generator.
+
+static inline uint64_t GetBlockIndex(Worker *w, int64_t i, bool random, int distribution) {
+	if (distribution != DISTRIBUTION_UNIFORM) {
+		const AccessDistribution *d = &access_distribution[distribution];
+		uint64_t block_index = d->Sample(&w->rng);
+		if (d->IsRanked())
+			block_index = rank_order.Get(block_index);
+		return block_index;
 	}
-	close(fd);
-	return blocks_processed;
+	return random ? random_order.Get(i) : i;
 }
 
-static int RandomWrite(ThreadedTimeout *tt) {
-	int fd = open(test_filename, O_WRONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	int blocks_processed = 0;
-	for (int i = 0; i < nu_blocks; i++) {
-		int block_index = indices[i];
-		lseek(fd, block_index * 4096, SEEK_SET);
-		write_with_check(fd, buffer, 4096);
+// Sequential or random access test, performing the worker's share of block
+// transactions. For uniform random access, every block is accessed once in the
+// order of the random permutation; with a skewed distribution, the blocks are
+// drawn from the whole test file range. In a mixed test, every transaction is
+// randomly chosen to be a read or a write. The test stops early when the
+// time-out (if any) is signalled.
+//
+// When a rate is set, the test runs open-loop: transactions are issued on a
+// fixed schedule, shared evenly by the workers, regardless of when earlier
+// transactions complete. Latency is measured from the scheduled time, so that
+// when the device cannot keep up, the time transactions spend waiting to be
+// issued is included (avoiding coordinated omission).
+//
+// When written data is verified and the engine can have several writes in
+// flight, the order in which they complete is tracked, since writes to the
+// same block may overtake each other.
+
+static int64_t BlockTest(Worker *w, int command_flags, int distribution, ThreadedTimeout *tt) {
+	IOEngine *engine = w->engine;
+	bool write_transaction = (command_flags & CMD_WRITE) != 0;
+	bool random = (command_flags & CMD_RANDOM) != 0;
+	bool mixed = (command_flags & CMD_MIXED) != 0;
+	// Give every worker a different, but repeatable, sequence.
+	w->rng.Seed(((uint64_t)random_seed << 32) + w->index);
+	int access_mode = O_RDONLY;
+	if (mixed)
+		access_mode = O_RDWR;
+	else if (write_transaction)
+		access_mode = O_WRONLY;
+	engine->Open(test_filename, access_mode | extra_mode_access_flags);
+	bool track_write_order = FlagIsSet(FLAG_VERIFY) && access_mode != O_RDONLY &&
+		engine->IsAsynchronous() && engine->GetQueueDepth() > 1;
+	w->write_order.Reset(track_write_order ? engine->GetQueueDepth() : 0);
+	if (track_write_order)
+		engine->SetWriteCompletionObserver(&w->write_order);
+	double target_iops = GetTargetIOPS();
+	double schedule_interval = 0;
+	uint64_t schedule_start_time = 0;
+	if (target_iops > 0) {
+		schedule_interval = NSecToTimeStamp(1000000000.0 * nu_threads / target_iops);
+		// Interleave the schedules of the workers.
+		schedule_start_time = GetTimeStamp() + (uint64_t)(schedule_interval * w->index /
+			nu_threads);
+	}
+	int64_t blocks_processed = 0;
+	for (int64_t i = w->first_block; i < w->first_block + w->nu_blocks; i++) {
+		uint64_t block_index = GetBlockIndex(w, i, random, distribution);
+		if (mixed)
+			write_transaction = w->rng.NextDouble() * 100.0 >= rwmix_read;
+		uint64_t scheduled_time = 0;
+		if (target_iops > 0) {
+			scheduled_time = schedule_start_time + (uint64_t)(schedule_interval *
+				blocks_processed);
+			if (!WaitForTimeStamp(w, scheduled_time, tt))
+				break;
+		}
+		if (write_transaction) {
+			char *buffer = GetWriteBuffer(w, block_size);
+			if (FlagIsSet(FLAG_VERIFY))
+				StampBlock(buffer, block_size, block_index * block_size,
+					verify_generation, w->index, i);
+			if (track_write_order)
+				w->write_order.WriteQueued(block_index * block_size, i);
+			engine->Write(buffer, block_size, block_index * block_size, scheduled_time);
+		}
+		else
+			engine->Read(GetReadBuffer(w), block_size, block_index * block_size,
+				scheduled_time);
 		blocks_processed++;
-		if (tt->StopSignalled())
+		CheckInterval(w);
+		if (tt != NULL && tt->StopSignalled())
 			break;
 	}
-	close(fd);
-	return blocks_processed;
+	engine->Close();
+	engine->SetWriteCompletionObserver(NULL);
+	return blocks_processed * block_size;
 }
 
-// Tests with a set number of 4K blocks.
+#define MAX_REPORTED_VERIFY_ERRORS 20
 
-static int SequentialRead() {
-	int fd = open(test_filename, O_RDONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	for (int i = 0; i < nu_blocks; i++) {
-		read_with_check(fd, buffer, 4096);
-	}
-	close(fd);
-	return nu_blocks;
+static void ReportVerifyError(Worker *w, uint64_t offset, int64_t sequence, int result,
+const BlockHeader *h) {
+	w->verify_errors++;
+	if (__atomic_fetch_add(&verify_errors_reported, 1, __ATOMIC_RELAXED) >=
+	MAX_REPORTED_VERIFY_ERRORS)
+		return;
+	char details[128];
+	details[0] = '\0';
+	if (result == VERIFY_WRONG_OFFSET)
+		sprintf(details, ", found block of offset %llu", (unsigned long long)h->offset);
+	else if (result == VERIFY_STALE && h->generation == verify_generation)
+		sprintf(details, ", found write %llu instead of %llu of the same test",
+			(unsigned long long)h->sequence, (unsigned long long)sequence);
+	else if (result == VERIFY_STALE)
+		sprintf(details, ", found block written by an earlier test");
+	// A single call, so that messages of concurrent workers are not mixed.
+	Message("Verify error at offset %llu (block %llu): %s%s\n", (unsigned long long)offset,
+		(unsigned long long)(offset / block_size), GetVerifyResultDescription(result),
+		details);
 }
 
-static int SequentialWrite() {
-	int fd = open(test_filename, O_WRONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	for (int i = 0; i < nu_blocks; i++)
-		write_with_check(fd, buffer, 4096);
+// Read back the blocks written by the worker in the last sequential or random
+// access test, repeating the sequence of transactions of the test, and check
+// them. For every block, the most recent write is expected; when a block was
+// written again by the same worker, the earlier transaction is not reported
+// as stale, since a later one overwrote it. When writes to a block completed
+// out of order, the one that completed last is expected instead. The test
+// file is read with the access flags of the test but synchronously,
+// regardless of the engine.
+
+static void VerifyBlocks(Worker *w, int command_flags, int distribution) {
+	bool write_transaction = (command_flags & CMD_WRITE) != 0;
+	bool random = (command_flags & CMD_RANDOM) != 0;
+	bool mixed = (command_flags & CMD_MIXED) != 0;
+	w->verify_blocks = 0;
+	w->verify_errors = 0;
+	w->rng.Seed(((uint64_t)random_seed << 32) + w->index);
+	int fd = open(test_filename, O_RDONLY | (extra_mode_access_flags & O_DIRECT));
+	if (fd < 0)
+		FatalError("Error opening file.\n");
+	char *buffer = w->buffers.Get(0);
+	w->buffer_overwritten[0] = true;
+	int64_t nu_transactions = w->bytes_processed / block_size;
+	for (int64_t i = w->first_block; i < w->first_block + nu_transactions; i++) {
+		uint64_t block_index = GetBlockIndex(w, i, random, distribution);
+		if (mixed)
+			write_transaction = w->rng.NextDouble() * 100.0 >= rwmix_read;
+		if (!write_transaction)
+			continue;
+		uint64_t offset = block_index * block_size;
+		if (pread(fd, buffer, block_size, offset) != block_size)
+			FatalError("Error during read operation.\n");
+		const BlockHeader *h = (const BlockHeader *)buffer;
+		int result = CheckBlock(buffer, block_size, offset, verify_generation);
+		uint64_t expected_sequence = i;
+		if (result == VERIFY_OK && h->worker == w->index) {
+			if (w->write_order.GetLastCompletedWrite(offset, &expected_sequence)) {
+				if (h->sequence != expected_sequence)
+					result = VERIFY_STALE;
+			}
+			else if (h->sequence < (uint64_t)i)
+				result = VERIFY_STALE;
+		}
+		w->verify_blocks++;
+		if (result != VERIFY_OK)
+			ReportVerifyError(w, offset, expected_sequence, result, h);
+	}
 	close(fd);
-	return nu_blocks;
 }
 
-static int RandomRead() {
-	int fd = open(test_filename, O_RDONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	for (int i = 0; i < nu_blocks; i++) {
-		int block_index = indices[i];
-		lseek(fd, (off_t)block_index * 4096, SEEK_SET);
-		read_with_check(fd, buffer, 4096);
+// Called by a worker when its position in its dispatch list has entered a new
+// chunk. Reads ahead, and releases the part of the trace that all workers
+// have passed.
+
+static void AdvanceTracePosition(Worker *w, Trace *trace, uint64_t dispatch_index) {
+	trace->AdviseDispatch(w->index, dispatch_index);
+	uint64_t position = trace->nu_records;
+	if (dispatch_index < trace->dispatch_start[w->index + 1])
+		position = trace->dispatch[dispatch_index];
+	__atomic_store_n(&w->trace_position, position, __ATOMIC_RELAXED);
+	trace->ReadAhead(position);
+	uint64_t min_position = position;
+	for (int i = 0; i < nu_threads; i++) {
+		uint64_t p = __atomic_load_n(&workers[i].trace_position, __ATOMIC_RELAXED);
+		if (p < min_position)
+			min_position = p;
 	}
-	close(fd);
-	return nu_blocks;
+	trace->Release(min_position);
 }
 
-static int RandomWrite() {
-	int fd = open(test_filename, O_WRONLY | extra_mode_access_flags);
-	CheckFDError(fd);
-	for (int i = 0; i < nu_blocks; i++) {
-		int block_index = indices[i];
-		lseek(fd, (off_t)block_index * 4096, SEEK_SET);
-		write_with_check(fd, buffer, 4096);
-	}
-	close(fd);
-	return nu_blocks;
+// Submit a queued transaction that has a schedule, record its delay relative
+// to the schedule, and clear the scheduled time so that this is done only
+// once. Transactions without a schedule are left to be submitted in batches.
+
+static inline void RecordReplayLag(Worker *w, uint64_t *scheduled_time) {
+	if (*scheduled_time == 0)
+		return;
+	w->engine->Flush();
+	uint64_t time = GetTimeStamp();
+	w->replay_lag.Record(time > *scheduled_time ?
+		TimeStampToNSec(time - *scheduled_time) : 0);
+	*scheduled_time = 0;
 }
 
-static int ExecuteTrace(Trace *trace, ThreadedTimeout *tt) {
-	int trace_bindex = 0;	// Index into trace data in bytes.
-	int fd = open(test_filename, O_RDWR | extra_mode_access_flags_trace);
-	CheckFDError(fd);
-	int nu_blocks_processed = 0;
+// Replay a trace, returning the total size of the transactions in bytes.
+// Transactions are split into 4K blocks as defined by the trace format; the
+// decoded records have already been split at block boundaries.
+//
+// With multiple workers, every worker replays the records of its dispatch
+// list: those of the streams assigned to it (stream number modulo the number
+// of workers), so that the order within each stream is preserved, or every
+// n-th record with round-robin dispatch.
+//
+// Timestamped records are issued at their recorded time relative to the first
+// timestamped record, divided by the trace speed, so that bursts and idle
+// periods are reproduced; the delay of each such record relative to its
+// schedule is recorded as replay lag. Other records, and all records when the
+// trace speed is 0, are issued as fast as possible.
+
+static int64_t ExecuteTrace(Worker *w, Trace *trace, ThreadedTimeout *tt) {
+	IOEngine *engine = w->engine;
+	engine->Open(test_filename, O_RDWR | extra_mode_access_flags_trace);
+	w->replay_lag.Reset();
+	memset(w->stream_stats, 0, sizeof(TraceStreamStatistics) * TRACE_MAX_STREAMS);
+	uint64_t start_time = current_trace_start_time;
 	uint64_t total_size = 0;
-	for (;;) {
-		if (trace_bindex >= trace->size)
-			break;
-		uint32_t first_word = *(uint32_t *)(&trace->data[trace_bindex]);
-		uint32_t second_word = *(uint32_t *)(&trace->data[trace_bindex + 4]);
-		// Optionally, the transaction may not be aligned at 4KB block boundaries.
-		int head_size = 0;
-		int tail_size = 0;
-		uint64_t size_in_blocks;
-		uint64_t location;
-		int write_transaction;
-		if ((first_word & 0x80000000) == 0) {
-			// Format 1: 8 bytes, 4K block units.
-			int write_transaction = (first_word & 0x40000000) >> 30;
-			int size_in_blocks = first_word & 0x3FFFFFFF;
-			location = (uint64_t)second_word * 4096;
-			trace_bindex += 8;
+	uint64_t first = trace->dispatch_start[w->index];
+	uint64_t end = trace->dispatch_start[w->index + 1];
+	AdvanceTracePosition(w, trace, first);
+	for (uint64_t k = first; k < end; k++) {
+		if ((k - first) % TRACE_CHUNK_RECORDS == 0 && k > first)
+			AdvanceTracePosition(w, trace, k);
+		uint64_t j = trace->dispatch[k];
+		uint32_t size_flags = trace->size_flags[j];
+		// The replay lag of a timed record is recorded once its first transaction
+		// has been submitted.
+		uint64_t scheduled_time = 0;
+		if ((size_flags & TRACE_RECORD_TIMED) != 0 && trace_speed > 0) {
+			scheduled_time = start_time +
+				(uint64_t)NSecToTimeStamp(trace->time[j] / trace_speed);
+			if (!WaitForTimeStamp(w, scheduled_time, tt))
+				break;
+			if (size_flags & TRACE_RECORD_CONTINUED)
+				scheduled_time = 0;
 		}
-		else if ((first_word & 0x40000000) == 0) {
-			// Format 2: 8 bytes, location in blocks, size in bytes.
-			int write_transaction = (first_word & 0x20000000) >> 29;
-			location = (uint64_t)(first_word & 0x1FFFFFFF) * 4096;
-			size_in_blocks = second_word / 4096;
-			tail_size = second_word - size_in_blocks * 4096;
-			trace_bindex += 8;
+		uint64_t location = trace->location[j];
+		uint32_t size = size_flags & TRACE_RECORD_SIZE_MASK;
+		total_size += size;
+		TraceStreamStatistics *stream =
+			&w->stream_stats[trace->stream != NULL ? trace->stream[j] : 0];
+		uint64_t nu_transactions = (size + 4095) / 4096;
+		if (size_flags & TRACE_RECORD_WRITE) {
+			stream->nu_writes += nu_transactions;
+			stream->write_bytes += size;
+			for (uint32_t offset = 0; offset < size; offset += 4096) {
+				uint32_t transaction_size = size - offset < 4096 ? size - offset : 4096;
+				engine->Write(GetWriteBuffer(w, transaction_size), transaction_size,
+					location + offset);
+				RecordReplayLag(w, &scheduled_time);
+			}
 		}
 		else {
-			// Format 3: 16 bytes, location and size in bytes.
-			uint64_t size = first_word | ((uint64_t)second_word << 32);
-			uint32_t third_word = *(uint32_t *)(&trace->data[trace_bindex + 8]);
-			uint32_t fourth_word = *(uint32_t *)(&trace->data[trace_bindex + 12]);
-			location = third_word | ((uint64_t)fourth_word << 32);
-			if ((location & 0xFFF) != 0) {
-				head_size = 4096 - (location & 0xFFF);
-				if (head_size > size)
-					head_size = size;
-				size -= head_size;
+			stream->nu_reads += nu_transactions;
+			stream->read_bytes += size;
+			for (uint32_t offset = 0; offset < size; offset += 4096) {
+				uint32_t transaction_size = size - offset < 4096 ? size - offset : 4096;
+				engine->Read(GetReadBuffer(w), transaction_size, location + offset);
+				RecordReplayLag(w, &scheduled_time);
 			}
-			size_in_blocks = size / 4096;
-			tail_size = size & 0xFFF;
-		}
-		total_size += size_in_blocks * 4096 + head_size + tail_size;
-		lseek(fd, (off_t)location, SEEK_SET);
-		// Handle head.
-		if (head_size > 0) {
-			if (write_transaction)
-				write_with_check(fd, buffer, head_size);
-			else
-				read_with_check(fd, buffer, head_size);
-			nu_blocks_processed++;
-		}
-		// Handle main part (block-aligned).
-		for (int i = 0; i < size_in_blocks; i++)
-			if (write_transaction)
-				write_with_check(fd, buffer, 4096);
-			else
-				read_with_check(fd, buffer, 4096);
-		nu_blocks_processed += size_in_blocks;
-		// Handle tail.
-		if (tail_size > 0) {
-			if (write_transaction)
-				write_with_check(fd, buffer, tail_size);
-			else
-				read_with_check(fd, buffer, tail_size);
-			nu_blocks_processed++;
 		}
+		stream->end_time = GetTimeStamp();
+		CheckInterval(w);
 		// When there is a set trace duration, check it.
 		if (FlagIsSet(FLAG_TRACE_DURATION))
 			if (tt->StopSignalled())
 				break;
 	}
-	close(fd);
-	// We can report nu_blocks_processed (which counts every head or tail, even a few bytes,
-	// as one 4K block, or use the total transaction size in bytes divided by the block size
-	// (which we do).
-	return total_size / 4096;
+	engine->Close();
+	AdvanceTracePosition(w, trace, end);
+	return total_size;
+}
+
+static void ReportLatency(const char *name, const LatencySummary *l) {
+	if (l->count == 0)
+		return;
+	Message("%s (usec): avg %.1lf", name, l->mean * 0.001);
+	for (int i = 0; i < NU_REPORTED_PERCENTILES; i++)
+		Message(", p%g %.1lf", reported_percentile[i], l->percentile[i] * 0.001);
+	Message(", max %.1lf\n", l->max * 0.001);
+}
+
+static void *WorkerThread(void *p) {
+	Worker *w = (Worker *)p;
+	w->tid = syscall(SYS_gettid);
+	for (;;) {
+		pthread_barrier_wait(&start_barrier);
+		if (current_command < 0)
+			break;
+		Timer timer;
+		timer.Start();
+		if (current_verify)
+			VerifyBlocks(w, test[current_command].command_flags,
+				test[current_command].distribution);
+		else if (test[current_command].command_flags & CMD_TRACE)
+			w->bytes_processed = ExecuteTrace(w, current_trace, current_tt);
+		else
+			w->bytes_processed = BlockTest(w, test[current_command].command_flags,
+				test[current_command].distribution, current_tt);
+		w->elapsed_time = timer.Elapsed();
+		__atomic_store_n(&w->finished, true, __ATOMIC_RELEASE);
+		pthread_barrier_wait(&finish_barrier);
+	}
+	return NULL;
+}
+
+static void StartWorkers() {
+	pthread_barrier_init(&start_barrier, NULL, nu_threads + 1);
+	pthread_barrier_init(&finish_barrier, NULL, nu_threads + 1);
+	workers = new Worker[nu_threads];
+	for (int i = 0; i < nu_threads; i++) {
+		Worker *w = &workers[i];
+		w->index = i;
+		w->engine = CreateIOEngine(io_engine_type, io_depth);
+		// Trace replay uses 4K transactions regardless of the block size.
+		w->data_generator.Seed(((uint64_t)random_seed << 32) + 0x40000000 + i);
+		CreateBuffers(&w->buffers, w->engine->GetQueueDepth(),
+			block_size > 4096 ? block_size : 4096, &w->data_generator);
+		w->engine->SetBufferPool(&w->buffers);
+		w->buffer_overwritten = new bool[w->engine->GetQueueDepth()]();
+		w->stream_stats = NULL;
+		if (trace_filenames.Size() > 0)
+			w->stream_stats = new TraceStreamStatistics[TRACE_MAX_STREAMS];
+		w->first_block = nu_blocks * i / nu_threads;
+		w->nu_blocks = nu_blocks * (i + 1) / nu_threads - w->first_block;
+		if (pthread_create(&w->thread, NULL, WorkerThread, w) != 0)
+			FatalError("Could not create worker thread.\n");
+	}
+}
+
+// Let the workers perform a test, and return when all of them are finished.
+
+static void RunWorkers(int command, Trace *trace, ThreadedTimeout *tt) {
+	current_command = command;
+	current_trace = trace;
+	if (trace != NULL) {
+		trace->Rewind();
+		for (int i = 0; i < nu_threads; i++)
+			workers[i].trace_position = 0;
+	}
+	current_trace_start_time = GetTimeStamp();
+	current_tt = tt;
+	pthread_barrier_wait(&start_barrier);
+	if (command >= 0)
+		pthread_barrier_wait(&finish_barrier);
+}
+
+static void StopWorkers() {
+	RunWorkers(- 1, NULL, NULL);
+	for (int i = 0; i < nu_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		delete workers[i].engine;
+		delete [] workers[i].stream_stats;
+		delete [] workers[i].buffer_overwritten;
+	}
+	delete [] workers;
+	pthread_barrier_destroy(&start_barrier);
+	pthread_barrier_destroy(&finish_barrier);
+}
+
+// Determine the number of block transactions per test for the current block
+// size, and set up the random access order. The order only depends on the
+// random seed and the number of blocks, so that it is the same for every test
+// with the same block size.
+
+static void SetupBlocks() {
+	nu_blocks = total_transaction_size / block_size;
+	random_order.Init(nu_blocks, random_seed);
+	uint64_t range_blocks = test_file_range / block_size;
+	rank_order.Init(range_blocks, (uint64_t)random_seed + 1);
+	access_distribution[DISTRIBUTION_ZIPF].Init(DISTRIBUTION_ZIPF, range_blocks, zipf_theta, 0);
+	access_distribution[DISTRIBUTION_PARETO].Init(DISTRIBUTION_PARETO, range_blocks,
+		pareto_shape, 0);
+	access_distribution[DISTRIBUTION_NORMAL].Init(DISTRIBUTION_NORMAL, range_blocks,
+		normal_stddev, 0);
+	access_distribution[DISTRIBUTION_HOT_COLD].Init(DISTRIBUTION_HOT_COLD, range_blocks,
+		hot_access_percentage, hot_range_percentage);
+}
+
+// Describe the distribution of a skewed random access test, or return NULL for
+// other tests.
+
+static const char *GetDistributionDescription(int com) {
+	static char s[64];
+	switch (test[com].distribution) {
+	case DISTRIBUTION_ZIPF :
+		sprintf(s, "zipf:%g", zipf_theta);
+		break;
+	case DISTRIBUTION_PARETO :
+		sprintf(s, "pareto:%g", pareto_shape);
+		break;
+	case DISTRIBUTION_NORMAL :
+		sprintf(s, "normal:%g", normal_stddev);
+		break;
+	case DISTRIBUTION_HOT_COLD :
+		sprintf(s, "hotcold:%g:%g", hot_access_percentage, hot_range_percentage);
+		break;
+	default :
+		return NULL;
+	}
+	return s;
+}
+
+// Change the block size, I/O depth and number of threads, restarting the
+// workers if any of them differs from the current configuration.
+
+static void ConfigureWorkers(int size, int depth, int threads) {
+	if (size == block_size && depth == io_depth && threads == nu_threads)
+		return;
+	StopWorkers();
+	io_depth = depth;
+	nu_threads = threads;
+	if (size != block_size) {
+		block_size = size;
+		SetupBlocks();
+	}
+	StartWorkers();
+}
+
+// Wait until every worker has either published the statistics of the given
+// interval or finished the test, and combine their statistics in
+// interval_sum.
+
+static void CollectInterval(int generation) {
+	interval_sum->Reset();
+	for (int i = 0; i < nu_threads; i++) {
+		Worker *w = &workers[i];
+		IntervalStatistics *s;
+		for (;;) {
+			if (__atomic_load_n(&w->interval_generation, __ATOMIC_ACQUIRE) == generation) {
+				s = &w->interval_stats[(generation - 1) & 1];
+				break;
+			}
+			// Check the generation again after seeing that the worker has
+			// finished, because it may have published just before finishing.
+			if (__atomic_load_n(&w->finished, __ATOMIC_ACQUIRE) &&
+			w->interval_generation != generation) {
+				s = &w->interval_stats[w->interval_generation & 1];
+				break;
+			}
+			usleep(100);
+		}
+		interval_sum->Add(s);
+		// A finished worker does not record anything anymore, but its current
+		// statistics must not be counted again for the next interval.
+		if (s == &w->interval_stats[w->interval_generation & 1])
+			s->Reset();
+	}
+}
+
+static void ReportIntervalLatency(const char *name, const LatencySummary *l) {
+	if (l->count == 0)
+		return;
+	Message(", %s p50/p99/max %.1lf/%.1lf/%.1lf usec", name, l->percentile[0] * 0.001,
+		l->percentile[2] * 0.001, l->max * 0.001);
+}
+
+// Report the results in interval_sum of an interval of the given length ending
+// at the given time since the start of the test.
+
+static void ReportInterval(double time, double length) {
+	TestResult *r = &interval_result;
+	IntervalStatistics *s = interval_sum;
+	r->time = time;
+	r->elapsed_time = length;
+	r->bytes_processed = s->read_bytes + s->write_bytes;
+	r->nu_transactions = s->nu_transactions;
+	r->bandwidth_MB = (double)r->bytes_processed / (1024 * 1024) / length;
+	r->iops = (double)s->nu_transactions / length;
+	r->read_bandwidth_MB = (double)s->read_bytes / (1024 * 1024) / length;
+	r->write_bandwidth_MB = (double)s->write_bytes / (1024 * 1024) / length;
+	r->read_iops = (double)s->read_latency.GetCount() / length;
+	r->write_iops = (double)s->write_latency.GetCount() / length;
+	r->read_latency.Set(&s->read_latency);
+	r->write_latency.Set(&s->write_latency);
+	Message("    %8.2lfs: %.2lfMB/s, %.0lf IOPS", time, r->bandwidth_MB, r->iops);
+	ReportIntervalLatency("read", &r->read_latency);
+	ReportIntervalLatency("write", &r->write_latency);
+	Message("\n");
+	OutputTestResult(r);
+}
+
+static void *IntervalReporterThread(void *p) {
+	uint64_t start_time = GetCurrentTimeNSec();
+	uint64_t interval_start_time = start_time;
+	uint64_t interval_nsec = (uint64_t)report_interval * 1000000000;
+	int generation = 0;
+	bool stop = false;
+	while (!stop) {
+		uint64_t end_time = start_time + (generation + 1) * interval_nsec;
+		uint64_t time;
+		// Sleep in short steps, so that the end of the test is noticed quickly.
+		for (;;) {
+			time = GetCurrentTimeNSec();
+			if (__atomic_load_n(&interval_reporter_stop, __ATOMIC_ACQUIRE)) {
+				stop = true;
+				break;
+			}
+			if (time >= end_time)
+				break;
+			uint64_t remaining_usec = (end_time - time) / 1000 + 1;
+			usleep(remaining_usec < 10000 ? remaining_usec : 10000);
+		}
+		generation++;
+		__atomic_store_n(&interval_generation, generation, __ATOMIC_RELEASE);
+		CollectInterval(generation);
+		// When the test has finished, the last (partial) interval ends at the
+		// moment the end was noticed.
+		if (!stop)
+			time = end_time;
+		if (time > interval_start_time && (!stop || interval_sum->nu_transactions > 0))
+			ReportInterval((double)(time - start_time) * 0.000000001d,
+				(double)(time - interval_start_time) * 0.000000001d);
+		interval_start_time = time;
+	}
+	return NULL;
+}
+
+// Prepare the workers for a new test, and start the interval reporter if
+// intervals are reported.
+
+static void StartIntervalReporter() {
+	interval_generation = 0;
+	for (int i = 0; i < nu_threads; i++) {
+		Worker *w = &workers[i];
+		w->interval_generation = 0;
+		w->finished = false;
+		w->interval_stats[0].Reset();
+		w->engine->SwapIntervalStatistics(report_interval > 0 ? &w->interval_stats[0] : NULL);
+	}
+	if (report_interval == 0)
+		return;
+	interval_reporter_stop = false;
+	if (pthread_create(&interval_reporter_thread, NULL, IntervalReporterThread, NULL) != 0)
+		FatalError("Could not create interval reporter thread.\n");
+}
+
+// Signal the interval reporter that the test has finished. The reporter
+// reports the last interval and exits; JoinIntervalReporter() waits for it.
+
+static void StopIntervalReporter() {
+	if (report_interval > 0)
+		__atomic_store_n(&interval_reporter_stop, true, __ATOMIC_RELEASE);
+}
+
+static void JoinIntervalReporter() {
+	if (report_interval > 0)
+		pthread_join(interval_reporter_thread, NULL);
+}
+
+// Set the parameters of a test in a result record.
+
+static void SetTestParameters(int com, const char *trace_filename, TestResult *result) {
+	bool trace_test = (test[com].command_flags & CMD_TRACE) != 0;
+	int access_flags = trace_test ? extra_mode_access_flags_trace : extra_mode_access_flags;
+	IOEngine *engine = workers[0].engine;
+	result->test_name = test[com].name;
+	result->trace_filename = trace_filename;
+	result->distribution = GetDistributionDescription(com);
+	result->rwmix_read = (test[com].command_flags & CMD_MIXED) ? rwmix_read : - 1;
+	result->target_iops = trace_test ? 0 : GetTargetIOPS();
+	result->replay_lag.count = 0;
+	result->stream = - 1;
+	result->engine_name = engine->Name();
+	result->io_depth = engine->GetQueueDepth();
+	result->nu_threads = nu_threads;
+	result->direct = (access_flags & O_DIRECT) != 0;
+	result->sync = (access_flags & O_SYNC) != 0;
+	result->block_size = trace_test ? 0 : block_size;
+	result->range = test_file_range;
+}
+
+static CPUStat *cpustat_before;
+static CPUStat *cpustat_after;
+static int max_process_threads = 0;
+static double *thread_ucpu = NULL;
+static double *thread_scpu = NULL;
+static LatencyHistogram *read_latency;
+static LatencyHistogram *write_latency;
+static LatencyHistogram *total_latency;
+static LatencyHistogram *replay_lag;
+static TraceStreamStatistics *stream_sum;	// Statistics of all trace streams.
+
+// Report the throughput of every stream of a trace replay that has more than
+// one stream. The throughput of a stream is measured over the time from the
+// start of the replay until the stream's last transaction was performed.
+
+static void ReportTraceStreams(int com, const char *trace_filename) {
+	int nu_streams = 0;
+	for (int i = 0; i < TRACE_MAX_STREAMS; i++) {
+		TraceStreamStatistics *sum = &stream_sum[i];
+		memset(sum, 0, sizeof(TraceStreamStatistics));
+		for (int j = 0; j < nu_threads; j++) {
+			const TraceStreamStatistics *s = &workers[j].stream_stats[i];
+			sum->nu_reads += s->nu_reads;
+			sum->nu_writes += s->nu_writes;
+			sum->read_bytes += s->read_bytes;
+			sum->write_bytes += s->write_bytes;
+			if (s->end_time > sum->end_time)
+				sum->end_time = s->end_time;
+		}
+		if (sum->nu_reads + sum->nu_writes > 0)
+			nu_streams++;
+	}
+	if (nu_streams <= 1)
+		return;
+	TestResult r;
+	SetTestParameters(com, trace_filename, &r);
+	r.interval = false;
+	r.queue_depth = 0;
+	r.ucpu = 0;
+	r.scpu = 0;
+	r.latency_p99 = 0;
+	r.read_latency.count = 0;
+	r.write_latency.count = 0;
+	Message("Streams: %d\n", nu_streams);
+	for (int i = 0; i < TRACE_MAX_STREAMS; i++) {
+		const TraceStreamStatistics *s = &stream_sum[i];
+		if (s->nu_reads + s->nu_writes == 0)
+			continue;
+		double elapsed_time = (double)TimeStampToNSec(s->end_time -
+			current_trace_start_time) * 0.000000001;
+		if (elapsed_time <= 0)
+			elapsed_time = 0.000000001;
+		r.stream = i;
+		r.time = elapsed_time;
+		r.elapsed_time = elapsed_time;
+		r.bytes_processed = s->read_bytes + s->write_bytes;
+		r.nu_transactions = s->nu_reads + s->nu_writes;
+		r.bandwidth_MB = (double)r.bytes_processed / (1024 * 1024) / elapsed_time;
+		r.iops = (double)r.nu_transactions / elapsed_time;
+		r.read_bandwidth_MB = (double)s->read_bytes / (1024 * 1024) / elapsed_time;
+		r.write_bandwidth_MB = (double)s->write_bytes / (1024 * 1024) / elapsed_time;
+		r.read_iops = (double)s->nu_reads / elapsed_time;
+		r.write_iops = (double)s->nu_writes / elapsed_time;
+		Message("    Stream %d: %.1lfMB in %.2lfs (%.2lfMB/s, %.0lf IOPS)\n", i,
+			(double)r.bytes_processed / (1024 * 1024), elapsed_time, r.bandwidth_MB, r.iops);
+		OutputTestResult(&r);
+	}
+}
+
+// Read back and check the blocks written by the last test (--verify). The
+// page cache is emptied first, so that the data is read from the device.
+
+static void VerifyTest(int com) {
+	DropCaches();
+	verify_errors_reported = 0;
+	Timer timer;
+	timer.Start();
+	current_verify = true;
+	RunWorkers(com, NULL, NULL);
+	current_verify = false;
+	double elapsed_time = timer.Elapsed();
+	uint64_t nu_blocks_verified = 0;
+	uint64_t nu_errors = 0;
+	for (int j = 0; j < nu_threads; j++) {
+		nu_blocks_verified += workers[j].verify_blocks;
+		nu_errors += workers[j].verify_errors;
+	}
+	verify_errors_total += nu_errors;
+	double verified_MB = (double)nu_blocks_verified * block_size / (1024 * 1024);
+	Message("Verified %.1lfMB in %.2lfs (%.2lfMB/s, CRC32C%s): ", verified_MB, elapsed_time,
+		verified_MB / elapsed_time, CRC32CIsAccelerated() ? " accelerated" : "");
+	if (nu_errors == 0)
+		Message("no errors\n");
+	else
+		Message("%llu corrupted or stale block%s\n", (unsigned long long)nu_errors,
+			nu_errors == 1 ? "" : "s");
+	if (nu_errors > MAX_REPORTED_VERIFY_ERRORS)
+		Message("Only the first %d errors were reported.\n", MAX_REPORTED_VERIFY_ERRORS);
+}
+
+// Perform a single benchmark test (or trace replay) and report the results.
+
+static void RunTest(int com, Trace *trace, const char *trace_filename, TestResult *result) {
+	char s[16];
+	IOEngine *engine = workers[0].engine;
+	if (trace != NULL)
+		trace->Dispatch(nu_threads, trace_dispatch);
+	// The random access order and the skewed distributions are empty when the
+	// range holds no whole block.
+	if (!(test[com].command_flags & CMD_TRACE) && test_file_range < block_size) {
+		char s2[16];
+		FatalError("Test file range %s is smaller than the block size %s.\n",
+			FormatSize(test_file_range, s), FormatSize(block_size, s2));
+	}
+	DropCaches();
+	Message("Benchmark: %s", test[com].description);
+	Message("  Engine: %s", engine->Name());
+	if (engine->IsAsynchronous())
+		Message(" (iodepth %d)", engine->GetQueueDepth());
+	if (nu_threads > 1)
+		Message("  Threads: %d", nu_threads);
+	// Print limits determining how long the test will be run.
+	uint32_t timeout_secs = 0;
+	int64_t tr_size;
+	if (test[com].command_flags & CMD_TRACE) {
+		Message(" %s", trace_filename);
+		if (trace_speed == 0)
+			Message("  Speed: max");
+		else if (trace_speed != 1.0)
+			Message("  Speed: %gx", trace_speed);
+		if (FlagIsSet(FLAG_TRACE_DURATION))
+			timeout_secs = trace_duration;
+		tr_size = 0;
+	}
+	else {
+		Message("  Block size: %s", FormatSize(block_size, s));
+		if (test[com].distribution != DISTRIBUTION_UNIFORM)
+			Message("  Distribution: %s", GetDistributionDescription(com));
+		if (test[com].command_flags & CMD_MIXED)
+			Message("  Reads: %g%%", rwmix_read);
+		if (rate > 0 && rate_in_bytes)
+			Message("  Rate: %.1lfMB/s", rate / 1024.0);
+		else if (rate > 0)
+			Message("  Rate: %d IOPS", rate);
+		if (!FlagIsSet(FLAG_NO_DURATION))
+			timeout_secs = duration;
+		tr_size = total_transaction_size;
+	}
+	if ((test[com].command_flags & (CMD_WRITE | CMD_MIXED | CMD_TRACE)) != 0 &&
+	data_pattern.type != DATA_PATTERN_RAMP) {
+		char pattern_description[64];
+		Message("  Data: %s", data_pattern.GetDescription(pattern_description));
+	}
+	if (timeout_secs == 0 && tr_size == 0)
+		Message("  No limits");
+	else {
+		Message("  Limits: ");
+		if (tr_size != 0)
+			Message("Total size: %dMB", RoundToMB(tr_size));
+		if (timeout_secs != 0)
+			Message(" Duration: %ds", timeout_secs);
+	}
+	Message("\n");
+
+	ThreadedTimeout *tt = NULL;
+	if (timeout_secs > 0) {
+		tt = new ThreadedTimeout();
+		tt->Start((uint64_t)timeout_secs * 1000000);
+	}
+	for (int j = 0; j < nu_threads; j++)
+		workers[j].engine->ResetStatistics();
+	if (report_interval > 0) {
+		SetTestParameters(com, trace_filename, &interval_result);
+		interval_result.interval = true;
+		interval_result.queue_depth = 0;
+		interval_result.ucpu = 0;
+		interval_result.scpu = 0;
+		interval_result.latency_p99 = 0;
+	}
+	verify_generation++;
+	cpustat_before->Update();
+	Timer timer;
+	timer.Start();
+	StartIntervalReporter();
+	RunWorkers(com, trace, tt);
+	StopIntervalReporter();
+	Sync();
+	double elapsed_time = timer.Elapsed();
+	cpustat_after->Update();
+	JoinIntervalReporter();
+	if (timeout_secs > 0)
+		delete tt;
+	double ucpu, scpu;
+	int nu_process_threads = cpustat_after->GetNumberOfThreads();
+	if (nu_process_threads > max_process_threads) {
+		delete [] thread_ucpu;
+		delete [] thread_scpu;
+		max_process_threads = nu_process_threads;
+		thread_ucpu = new double[max_process_threads];
+		thread_scpu = new double[max_process_threads];
+	}
+	cpustat_after->GetUsageFrom(cpustat_before, &ucpu, &scpu, thread_ucpu, thread_scpu);
+	int64_t bytes_processed = 0;
+	uint64_t nu_transactions = 0;
+	uint64_t read_bytes = 0;
+	uint64_t write_bytes = 0;
+	double queue_depth = 0;
+	read_latency->Reset();
+	write_latency->Reset();
+	for (int j = 0; j < nu_threads; j++) {
+		read_latency->Add(&workers[j].engine->read_latency);
+		write_latency->Add(&workers[j].engine->write_latency);
+		read_bytes += workers[j].engine->read_bytes;
+		write_bytes += workers[j].engine->write_bytes;
+		bytes_processed += workers[j].bytes_processed;
+		nu_transactions += workers[j].engine->nu_transactions;
+		// The queue depths of concurrent workers add up.
+		queue_depth += workers[j].engine->GetAverageQueueDepth();
+	}
+	double processed_MB = (double)bytes_processed / (1024 * 1024);
+	double bandwidth_MB = processed_MB / elapsed_time;
+	double iops = (double)nu_transactions / elapsed_time;
+	Message("%.1lfMB processed in %.2lfs (%.2lfMB/s, %.0lf IOPS, average QD %.1lf), "
+		"CPU: user %.2lf%%, sys %.2lf%%\n", processed_MB, elapsed_time, bandwidth_MB,
+		iops, queue_depth, ucpu, scpu);
+	SetTestParameters(com, trace_filename, result);
+	result->interval = false;
+	result->time = elapsed_time;
+	result->read_bandwidth_MB = (double)read_bytes / (1024 * 1024) / elapsed_time;
+	result->write_bandwidth_MB = (double)write_bytes / (1024 * 1024) / elapsed_time;
+	result->read_iops = (double)read_latency->GetCount() / elapsed_time;
+	result->write_iops = (double)write_latency->GetCount() / elapsed_time;
+	// Report reads and writes separately when both were performed.
+	if (read_bytes > 0 && write_bytes > 0)
+		Message("Read: %.1lfMB (%.2lfMB/s, %.0lf IOPS), write: %.1lfMB (%.2lfMB/s, %.0lf IOPS)\n",
+			(double)read_bytes / (1024 * 1024), result->read_bandwidth_MB, result->read_iops,
+			(double)write_bytes / (1024 * 1024), result->write_bandwidth_MB,
+			result->write_iops);
+	result->nu_transactions = nu_transactions;
+	result->read_latency.Set(read_latency);
+	result->write_latency.Set(write_latency);
+	ReportLatency("Read latency", &result->read_latency);
+	ReportLatency("Write latency", &result->write_latency);
+	replay_lag->Reset();
+	for (int j = 0; j < nu_threads; j++)
+		replay_lag->Add(&workers[j].replay_lag);
+	result->replay_lag.Set(replay_lag);
+	ReportLatency("Replay lag", &result->replay_lag);
+	result->bytes_processed = bytes_processed;
+	result->elapsed_time = elapsed_time;
+	result->bandwidth_MB = bandwidth_MB;
+	result->iops = iops;
+	result->queue_depth = queue_depth;
+	result->ucpu = ucpu;
+	result->scpu = scpu;
+	total_latency->Reset();
+	total_latency->Add(read_latency);
+	total_latency->Add(write_latency);
+	result->latency_p99 = total_latency->GetPercentile(99.0);
+	OutputTestResult(result);
+	if (test[com].command_flags & CMD_TRACE)
+		ReportTraceStreams(com, trace_filename);
+	// Report the results of each worker.
+	for (int j = 0; nu_threads > 1 && j < nu_threads; j++) {
+		Worker *w = &workers[j];
+		double w_processed_MB = (double)w->bytes_processed / (1024 * 1024);
+		Message("    Thread %d: %.1lfMB in %.2lfs (%.2lfMB/s, %.0lf IOPS)", j,
+			w_processed_MB, w->elapsed_time, w_processed_MB / w->elapsed_time,
+			(double)w->engine->nu_transactions / w->elapsed_time);
+		for (int k = 0; k < nu_process_threads; k++)
+			if (cpustat_after->GetThreadID(k) == w->tid) {
+				if (thread_ucpu[k] >= 0)
+					Message(", CPU: user %.2lf%%, sys %.2lf%%", thread_ucpu[k],
+						thread_scpu[k]);
+				break;
+			}
+		Message("\n");
+	}
+	if (FlagIsSet(FLAG_VERIFY) && (test[com].command_flags & (CMD_WRITE | CMD_MIXED)) != 0 &&
+	(test[com].command_flags & CMD_TRACE) == 0)
+		VerifyTest(com);
+}
+
+// A point of a sweep.
+
+class SweepPoint {
+public :
+	int block_size;
+	int nu_threads;
+	int io_depth;
+	int rate;
+};
+
+// Whether point b continues the series of point a, within which the knee is
+// determined: the block size is the same and the load increases. The load is
+// the concurrency (threads multiplied by I/O depth) or, for points at the same
+// concurrency, the target rate.
+
+static bool ContinuesSeries(const SweepPoint *a, const SweepPoint *b) {
+	if (b->block_size != a->block_size)
+		return false;
+	int concurrency_a = a->nu_threads * a->io_depth;
+	int concurrency_b = b->nu_threads * b->io_depth;
+	if (b->nu_threads == a->nu_threads && b->io_depth == a->io_depth)
+		return b->rate > a->rate;
+	return b->rate == a->rate && concurrency_b > concurrency_a;
+}
+
+// Run a test for every combination of the block sizes, numbers of threads,
+// I/O depths and rates to sweep, and print a table of the results. Within a
+// series of increasing load at the same block size, the knee is marked: the
+// last point before the p99 latency starts rising faster than the throughput.
+
+static void RunSweep(int com) {
+	TightIntArray sizes(4);
+	TightIntArray threads(4);
+	TightIntArray depths(4);
+	TightIntArray rates(4);
+	for (int i = 0; i < sweep_block_sizes.Size(); i++)
+		sizes.Add(sweep_block_sizes.Get(i));
+	if (sizes.Size() == 0)
+		sizes.Add(default_block_size);
+	for (int i = 0; i < sweep_nu_threads.Size(); i++)
+		threads.Add(sweep_nu_threads.Get(i));
+	if (threads.Size() == 0)
+		threads.Add(default_nu_threads);
+	for (int i = 0; i < sweep_io_depths.Size(); i++)
+		depths.Add(sweep_io_depths.Get(i));
+	if (depths.Size() == 0)
+		depths.Add(default_io_depth);
+	for (int i = 0; i < sweep_rates.Size(); i++)
+		rates.Add(sweep_rates.Get(i));
+	if (rates.Size() == 0)
+		rates.Add(default_rate);
+	int n = sizes.Size() * threads.Size() * depths.Size() * rates.Size();
+	TestResult *results = new TestResult[n];
+	SweepPoint *points = new SweepPoint[n];
+	int k = 0;
+	for (int i = 0; i < sizes.Size(); i++)
+		for (int j = 0; j < threads.Size(); j++)
+			for (int l = 0; l < depths.Size(); l++)
+				for (int m = 0; m < rates.Size(); m++) {
+					SweepPoint *p = &points[k];
+					p->block_size = sizes.Get(i);
+					p->nu_threads = threads.Get(j);
+					p->io_depth = depths.Get(l);
+					p->rate = rates.Get(m);
+					ConfigureWorkers(p->block_size, p->io_depth, p->nu_threads);
+					rate = p->rate;
+					RunTest(com, NULL, NULL, &results[k]);
+					k++;
+				}
+	bool rate_sweep = sweep_rates.Size() > 0;
+	Message("Sweep: %s\n", test[com].description);
+	Message("    Block size  Threads  Depth%s        MB/s        IOPS  p99 (usec)\n",
+		rate_sweep ? (rate_in_bytes ? "  Rate (MB/s)" : "  Rate (IOPS)") : "");
+	bool knee_found = false;
+	for (int i = 0; i < n; i++) {
+		char s[16];
+		SweepPoint *p = &points[i];
+		Message("    %10s  %7d  %5d", FormatSize(p->block_size, s), p->nu_threads, p->io_depth);
+		if (rate_sweep && rate_in_bytes)
+			Message("  %11.1lf", p->rate / 1024.0);
+		else if (rate_sweep)
+			Message("  %11d", p->rate);
+		Message("  %10.2lf  %10.0lf  %10.1lf", results[i].bandwidth_MB, results[i].iops,
+			results[i].latency_p99 * 0.001);
+		if (i == 0 || !ContinuesSeries(&points[i - 1], p))
+			knee_found = false;
+		// Look ahead to the next point of the same series.
+		if (!knee_found && i + 1 < n && ContinuesSeries(p, &points[i + 1]) &&
+		results[i].iops > 0 && results[i].latency_p99 > 0) {
+			double throughput_gain = results[i + 1].iops / results[i].iops;
+			double latency_gain = (double)results[i + 1].latency_p99 /
+				results[i].latency_p99;
+			if (latency_gain > throughput_gain) {
+				Message("  <- knee");
+				knee_found = true;
+			}
+		}
+		Message("\n");
+	}
+	delete [] results;
+	delete [] points;
+	rate = default_rate;
+	ConfigureWorkers(default_block_size, default_io_depth, default_nu_threads);
 }
 
 int main(int argc, char *argv[]) {
@@ -694,17 +2120,45 @@ int main(int argc, char *argv[]) {
 #endif
 	ParseOptions(argc, argv);
 
-	// Reset the random number generator
-	if (FlagIsSet(FLAG_RANDOM_SEED))
-		srandom(random_seed);
-	else if (FlagIsSet(FLAG_RANDOM_SEED_TIME))
-		srandom((uint32_t)(GetCurrentTime() * 1000.0));
-	else
+	// Only analyze the traces when requested.
+	if (FlagIsSet(FLAG_TRACE_STATS)) {
+		if (trace_filenames.Size() == 0)
+			FatalError("No trace files specified (use trace=[FILENAME]).\n");
+		for (int i = 0; i < trace_filenames.Size(); i++)
+			AnalyzeTrace(trace_filenames.Get(i));
+		exit(0);
+	}
+
+	// Set up structured output. When it is written to standard output, other
+	// messages are written to standard error.
+	if (output_format != OUTPUT_FORMAT_TEXT) {
+		FILE *f = stdout;
+		if (output_filename != NULL) {
+			f = fopen(output_filename, "w");
+			if (f == NULL)
+				FatalError("Could not create output file %s.\n", output_filename);
+		}
+		else
+			message_stream = stderr;
+		BeginOutput(output_format, f);
+	}
+
+	// Determine the seed of the random number generator.
+	if (FlagIsSet(FLAG_RANDOM_SEED_TIME))
+		random_seed = (uint32_t)(GetCurrentTime() * 1000.0);
+	else if (!FlagIsSet(FLAG_RANDOM_SEED))
 		// By default, the random number patttern is deterministic and random access
 		// benchmarks are repeatable (same access pattern).
-		srandom(0);
+		random_seed = 0;
+
+	// Set up and report the clock used for latency measurements.
+	if (FlagIsSet(FLAG_TSC_TIME_STAMPS) && !EnableTSCTimeStamps())
+		Message("Warning: No invariant time stamp counter available, using system clock.\n");
+	Message("Timer: %s (resolution %d ns)", TIMER_CLOCK_NAME, (int)GetTimerResolution());
+	if (tsc_time_stamps)
+		Message(", latency time stamps from TSC (%.3lf GHz)", 1.0 / tsc_nsec_per_tick);
+	Message(", time stamp overhead %.1lf ns\n", MeasureTimeStampOverhead());
 
-	CreateBuffer();
 	CheckTestFile();
 
 	// Validate tests (make sure the amount of transactions does not exceed
@@ -718,11 +2172,10 @@ int main(int argc, char *argv[]) {
 	// at the total test file size.
 	if (!FlagIsSet(FLAG_TOTAL_TRANSACTION_SIZE) && !FlagIsSet(FLAG_NO_DURATION))
 		total_transaction_size = test_file_range;
-	nu_blocks = total_transaction_size >> 12;
 
 	// Set file access mode variables.
-	int extra_mode_access_flags = 0;
-	int extra_mode_access_flags_trace = 0;
+	extra_mode_access_flags = 0;
+	extra_mode_access_flags_trace = 0;
 	if (FlagIsSet(FLAG_ACCESS_MODE_SYNC)) {
 		extra_mode_access_flags = O_SYNC;
 		extra_mode_access_flags_trace = O_SYNC;
@@ -734,112 +2187,67 @@ int main(int argc, char *argv[]) {
 		extra_mode_access_flags_trace |= O_DIRECT;
 	}
 
-	CreateIndices();
-	SetRandomIndices();
+	block_size = default_block_size;
+	io_depth = default_io_depth;
+	nu_threads = default_nu_threads;
+	rate = default_rate;
+	SetupBlocks();
 
 	// Prepare traces.
 	PrepareTraces();
 
+	// Make the blocks written with --verify distinguishable from those of
+	// earlier runs.
+	verify_generation = (GetCurrentTimeNSec() ^ getpid()) << 16;
+	if (FlagIsSet(FLAG_VERIFY) && trace_filenames.Size() > 0)
+		Message("Warning: Trace file tests are not verified.\n");
+
+	StartWorkers();
+	IOEngine *engine = workers[0].engine;
+	if (!engine->IsAsynchronous() && (io_depth > 1 || sweep_io_depths.Size() > 0))
+		Message("Warning: I/O depth ignored for synchronous engine %s.\n", engine->Name());
+	if (engine->RequiresDirectAccess() && !FlagIsSet(FLAG_ACCESS_MODE_DIRECT))
+		Message("Warning: Engine %s only performs asynchronous I/O with --direct.\n",
+			engine->Name());
+
 	int trace_index = 0;
 	int pid = getpid();
-	CPUStat *cpustat_before = AllocateCPUStat(pid);
-	CPUStat *cpustat_after = AllocateCPUStat(pid);
+	cpustat_before = AllocateCPUStat(pid);
+	cpustat_after = AllocateCPUStat(pid);
+	read_latency = new LatencyHistogram;
+	write_latency = new LatencyHistogram;
+	total_latency = new LatencyHistogram;
+	replay_lag = new LatencyHistogram;
+	stream_sum = new TraceStreamStatistics[TRACE_MAX_STREAMS];
+	interval_sum = new IntervalStatistics;
 	for (int i = 0; i < commands.Size(); i++) {
-		DropCaches();
 		int com = commands.Get(i);
-		Message("Benchmark: %s", test[com].description);
-		// Print limits determining how long the test will be run.
-		uint32_t timeout_secs = 0;
-		int64_t tr_size;
-		if (test[com].command_flags & CMD_TRACE) {
-			Message(" %s", trace_filenames.Get(trace_index));
-			if (FlagIsSet(FLAG_TRACE_DURATION))
-				timeout_secs = trace_duration;
-			tr_size = 0;
-		}
-		else {
-			if (!FlagIsSet(FLAG_NO_DURATION))
-				timeout_secs = duration;
-			tr_size = total_transaction_size;
-		}
-		if (timeout_secs == 0 && tr_size == 0)
-			Message("  No limits");
-		else {
-			Message("  Limits: ");
-			if (tr_size != 0)
-				Message("Total size: %dMB", RoundToMB(tr_size));
-			if (timeout_secs != 0)
-				Message(" Duration: %ds", timeout_secs);
-		}
-		Message("\n");
-
-		ThreadedTimeout *tt;
-		if (timeout_secs > 0) {
-			tt = new ThreadedTimeout();
-			tt->Start((uint64_t)timeout_secs * 1000000);
-		}
-		cpustat_before->Update();
-		int blocks_processed;
-		Timer timer;
-		timer.Start();
+		TestResult result;
 		if (test[com].command_flags & CMD_TRACE) {
-			blocks_processed = ExecuteTrace(traces.Get(trace_index), tt);
+			RunTest(com, traces.Get(trace_index), trace_filenames.Get(trace_index), &result);
 			trace_index++;
 		}
-		else if (FlagIsSet(FLAG_NO_DURATION)) {
-			blocks_processed = nu_blocks;
-			switch (test[com].command_flags) {
-			case CMD_READ_SEQUENTIAL :
-				SequentialRead();
-				break;
-			case CMD_WRITE_SEQUENTIAL :
-				SequentialWrite();
-				break;
-			case CMD_READ_RANDOM :
-				RandomRead();
-				break;
-			case CMD_WRITE_RANDOM :
-				RandomWrite();
-				break;
-			default :
-				Message("Benchmark test unimplemented.\n");
-				blocks_processed = 0;
-				break;
-			}
-		}
-		else {
-			switch (test[com].command_flags) {
-			case CMD_READ_SEQUENTIAL :
-				blocks_processed = SequentialRead(tt);
-				break;
-			case CMD_WRITE_SEQUENTIAL :
-				blocks_processed = SequentialWrite(tt);
-				break;
-			case CMD_READ_RANDOM :
-				blocks_processed = RandomRead(tt);
-				break;
-			case CMD_WRITE_RANDOM :
-				blocks_processed = RandomWrite(tt);
-				break;
-			default :
-				blocks_processed = 0;
-				Message("Benchmark test unimplemented.\n");
-				break;
-			}
-		}
-		Sync();
-		double elapsed_time = timer.Elapsed();
-		cpustat_after->Update();
-		if (timeout_secs > 0)
-			delete tt;
-		double ucpu, scpu;
-		cpustat_after->GetUsageFrom(cpustat_before, &ucpu, &scpu, NULL, NULL);
-		double processed_MB = (double)((int64_t)blocks_processed * 4096) / (1024 * 1024);
-		double bandwidth_MB = processed_MB / elapsed_time;
-		Message("%.1lfMB processed in %.2lfs (%.2lfMB/s), CPU: user %.2lf%%, sys %.2lf%%\n",
-			processed_MB, elapsed_time, bandwidth_MB, ucpu, scpu);
+		else if (sweep_block_sizes.Size() > 0 || sweep_io_depths.Size() > 0 ||
+		sweep_nu_threads.Size() > 0 || sweep_rates.Size() > 0)
+			RunSweep(com);
+		else
+			RunTest(com, NULL, NULL, &result);
 	}
 
-	DestroyBuffer();
+	StopWorkers();
+	EndOutput();
+	for (int i = 0; i < traces.Size(); i++) {
+		traces.Get(i)->Close();
+		delete traces.Get(i);
+	}
+	delete [] thread_ucpu;
+	delete [] thread_scpu;
+	delete read_latency;
+	delete write_latency;
+	delete total_latency;
+	delete replay_lag;
+	delete [] stream_sum;
+	delete interval_sum;
+	// Let scripts detect data corruption found with --verify.
+	return verify_errors_total > 0 ? 2 : 0;
 }
-
@@ -0,0 +1,597 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+#include <linux/aio_abi.h>
+
+#include "flash-bench.h"
+#include "timer.h"
+#include "latency-histogram.h"
+#include "buffer-pool.h"
+#include "io-engine.h"
+
+static const char *io_engine_name[NU_IO_ENGINES] = {
+	"psync", "sync", "io_uring", "libaio"
+};
+
+IOEngine::IOEngine() {
+	fd = - 1;
+	queue_depth = 1;
+	interval = NULL;
+	buffers = NULL;
+	write_observer = NULL;
+	ResetStatistics();
+}
+
+IOEngine::~IOEngine() {
+	if (fd >= 0)
+		Close();
+}
+
+void IOEngine::Open(const char *filename, int flags) {
+	fd = open(filename, flags);
+	if (fd < 0)
+		FatalError("Error opening file.\n");
+}
+
+void IOEngine::Close() {
+	close(fd);
+	fd = - 1;
+}
+
+void IOEngine::Idle(uint64_t nsec) {
+	if (nsec > 0)
+		usleep(nsec / 1000);
+}
+
+// Positional I/O engine. Each transaction takes a single system call, and the
+// file offset is never changed.
+
+class PSyncIOEngine : public IOEngine {
+public :
+	const char *Name() const {
+		return io_engine_name[IO_ENGINE_PSYNC];
+	}
+	void Read(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		uint64_t start_time = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		ssize_t size_read = pread(fd, buffer, size, (off_t)offset);
+		if (size_read != size)
+			FatalError("Error during read operation.\n");
+		RecordCompletion(false, size, TimeStampToNSec(GetTimeStamp() - start_time));
+		nu_transactions++;
+		queue_depth_sum++;
+	}
+	void Write(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		uint64_t start_time = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		ssize_t size_written = pwrite(fd, buffer, size, (off_t)offset);
+		if (size_written != size)
+			FatalError("Error during write operation.\n");
+		RecordCompletion(true, size, TimeStampToNSec(GetTimeStamp() - start_time));
+		nu_transactions++;
+		queue_depth_sum++;
+	}
+};
+
+// Traditional engine using lseek() followed by read() or write(). The current
+// file position is tracked so that sequential access does not need an lseek()
+// for every transaction.
+
+class SyncIOEngine : public IOEngine {
+private :
+	uint64_t position;
+
+	void Seek(uint64_t offset) {
+		if (offset == position)
+			return;
+		if (lseek(fd, (off_t)offset, SEEK_SET) == (off_t)- 1)
+			FatalError("Error during seek operation.\n");
+		position = offset;
+	}
+public :
+	const char *Name() const {
+		return io_engine_name[IO_ENGINE_SYNC];
+	}
+	void Open(const char *filename, int flags) {
+		IOEngine::Open(filename, flags);
+		position = 0;
+	}
+	void Read(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		uint64_t start_time = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		Seek(offset);
+		ssize_t size_read = read(fd, buffer, size);
+		if (size_read != size)
+			FatalError("Error during read operation.\n");
+		RecordCompletion(false, size, TimeStampToNSec(GetTimeStamp() - start_time));
+		position += size;
+		nu_transactions++;
+		queue_depth_sum++;
+	}
+	void Write(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		uint64_t start_time = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		Seek(offset);
+		ssize_t size_written = write(fd, buffer, size);
+		if (size_written != size)
+			FatalError("Error during write operation.\n");
+		RecordCompletion(true, size, TimeStampToNSec(GetTimeStamp() - start_time));
+		position += size;
+		nu_transactions++;
+		queue_depth_sum++;
+	}
+};
+
+// The interval at which completions are polled while idle when the engine
+// cannot wait for them with a time-out.
+#define IDLE_POLL_INTERVAL 20000
+
+#ifdef __NR_io_uring_setup
+
+// Asynchronous engine using io_uring, accessed directly through the system call
+// interface so that liburing is not required. Transactions are collected in
+// the submission ring and submitted together with a single io_uring_enter()
+// by Flush(), or when all slots are in use, in which case the same system call
+// waits until a transaction has completed. Completions are reaped from the
+// completion ring without a system call.
+
+class IOUringIOEngine : public IOEngine {
+private :
+	int ring_fd;
+	// Submission queue ring.
+	uint8_t *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_ring_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	// Completion queue ring.
+	uint8_t *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_ring_mask;
+	struct io_uring_cqe *cqes;
+	int nu_queued;		// Transactions queued but not yet submitted.
+	int nu_in_flight;	// Transactions submitted but not yet completed.
+	// Every outstanding transaction occupies a slot, of which the index is
+	// stored as user data in the submission queue entry.
+	int *free_slots;	// Stack of unused slots.
+	int nu_free_slots;
+	size_t *slot_size;
+	bool *slot_write;
+	uint64_t *slot_time;
+	void **slot_buffer;
+	uint64_t *slot_offset;
+	bool wait_with_timeout;	// Whether io_uring_enter() supports a time-out.
+
+	// Submit all queued transactions and wait for at least min_complete
+	// completions. The wait may end early when interrupted by a signal.
+	void Submit(int min_complete) {
+		do {
+			int r = syscall(__NR_io_uring_enter, ring_fd, nu_queued, min_complete,
+				min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				FatalError("Error during io_uring_enter().\n");
+			}
+			nu_queued -= r;
+			nu_in_flight += r;
+			nu_transactions += r;
+			queue_depth_sum += (uint64_t)nu_in_flight * r;
+		} while (nu_queued > 0);
+	}
+	void Reap() {
+		unsigned int head = *cq_head;
+		unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			return;
+		uint64_t time = GetTimeStamp();
+		while (head != tail) {
+			struct io_uring_cqe *cqe = &cqes[head & *cq_ring_mask];
+			int slot = cqe->user_data;
+			if (cqe->res < 0 || (size_t)cqe->res != slot_size[slot])
+				FatalError("Error during asynchronous %s operation.\n",
+					cqe->res < 0 ? "I/O" : "read or write (short transfer)");
+			RecordCompletion(slot_write[slot], slot_size[slot],
+				TimeStampToNSec(time - slot_time[slot]));
+			if (write_observer != NULL && slot_write[slot])
+				write_observer->WriteCompleted(slot_buffer[slot], slot_size[slot],
+					slot_offset[slot]);
+			free_slots[nu_free_slots] = slot;
+			nu_free_slots++;
+			head++;
+			nu_in_flight--;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+	void Queue(int opcode, void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		while (nu_free_slots == 0) {
+			Submit(1);
+			Reap();
+		}
+		nu_free_slots--;
+		int slot = free_slots[nu_free_slots];
+		slot_size[slot] = size;
+		slot_write[slot] = (opcode == IORING_OP_WRITE);
+		slot_time[slot] = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		slot_buffer[slot] = buffer;
+		slot_offset[slot] = offset;
+		unsigned int tail = *sq_tail;
+		unsigned int index = tail & *sq_ring_mask;
+		struct io_uring_sqe *sqe = &sqes[index];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)buffer;
+		sqe->len = size;
+		sqe->off = offset;
+		sqe->user_data = slot;
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		nu_queued++;
+	}
+public :
+	IOUringIOEngine(int _queue_depth) {
+		queue_depth = _queue_depth;
+		nu_queued = 0;
+		nu_in_flight = 0;
+		free_slots = new int[queue_depth];
+		slot_size = new size_t[queue_depth];
+		slot_write = new bool[queue_depth];
+		slot_time = new uint64_t[queue_depth];
+		slot_buffer = new void *[queue_depth];
+		slot_offset = new uint64_t[queue_depth];
+		for (int i = 0; i < queue_depth; i++)
+			free_slots[i] = i;
+		nu_free_slots = queue_depth;
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+		if (ring_fd < 0)
+			FatalError("Could not set up io_uring (not supported by the kernel "
+				"or disabled?). Try --engine=psync.\n");
+#ifdef IORING_ENTER_EXT_ARG
+		wait_with_timeout = (params.features & IORING_FEAT_EXT_ARG) != 0;
+#else
+		wait_with_timeout = false;
+#endif
+		sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			if (cq_ring_size > sq_ring_size)
+				sq_ring_size = cq_ring_size;
+			cq_ring_size = sq_ring_size;
+		}
+		sq_ring = (uint8_t *)mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if (sq_ring == MAP_FAILED)
+			FatalError("Could not map io_uring submission queue.\n");
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			cq_ring = sq_ring;
+		else {
+			cq_ring = (uint8_t *)mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+			if (cq_ring == MAP_FAILED)
+				FatalError("Could not map io_uring completion queue.\n");
+		}
+		sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			FatalError("Could not map io_uring submission queue entries.\n");
+		sq_head = (unsigned int *)(sq_ring + params.sq_off.head);
+		sq_tail = (unsigned int *)(sq_ring + params.sq_off.tail);
+		sq_ring_mask = (unsigned int *)(sq_ring + params.sq_off.ring_mask);
+		sq_array = (unsigned int *)(sq_ring + params.sq_off.array);
+		cq_head = (unsigned int *)(cq_ring + params.cq_off.head);
+		cq_tail = (unsigned int *)(cq_ring + params.cq_off.tail);
+		cq_ring_mask = (unsigned int *)(cq_ring + params.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+	}
+	~IOUringIOEngine() {
+		if (fd >= 0)
+			Close();
+		munmap(sqes, sqes_size);
+		if (cq_ring != sq_ring)
+			munmap(cq_ring, cq_ring_size);
+		munmap(sq_ring, sq_ring_size);
+		close(ring_fd);
+		delete [] free_slots;
+		delete [] slot_size;
+		delete [] slot_write;
+		delete [] slot_time;
+		delete [] slot_buffer;
+		delete [] slot_offset;
+	}
+	const char *Name() const {
+		return io_engine_name[IO_ENGINE_IO_URING];
+	}
+	bool IsAsynchronous() const {
+		return true;
+	}
+	void Close() {
+		Wait();
+		IOEngine::Close();
+	}
+	void Read(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		Queue(IORING_OP_READ, buffer, size, offset, scheduled_time);
+	}
+	void Write(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		Queue(IORING_OP_WRITE, buffer, size, offset, scheduled_time);
+	}
+	char *GetBuffer() {
+		while (nu_free_slots == 0) {
+			Submit(1);
+			Reap();
+		}
+		// Queue() takes the slot on top of the stack.
+		return buffers->Get(free_slots[nu_free_slots - 1]);
+	}
+	void Flush() {
+		if (nu_queued > 0)
+			Submit(0);
+		Reap();
+	}
+	void Wait() {
+		while (nu_free_slots < queue_depth) {
+			Submit(1);
+			Reap();
+		}
+	}
+	void Idle(uint64_t nsec) {
+		Flush();
+		if (nsec == 0)
+			return;
+		if (nu_in_flight == 0) {
+			usleep(nsec / 1000);
+			return;
+		}
+#ifdef IORING_ENTER_EXT_ARG
+		if (wait_with_timeout) {
+			struct __kernel_timespec ts;
+			ts.tv_sec = nsec / 1000000000;
+			ts.tv_nsec = nsec % 1000000000;
+			struct io_uring_getevents_arg arg;
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+			// Returns early when a transaction completes, or with ETIME.
+			syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS |
+				IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+			Reap();
+			return;
+		}
+#endif
+		// Without a time-out, poll the completion ring at short intervals.
+		if (nsec > IDLE_POLL_INTERVAL)
+			nsec = IDLE_POLL_INTERVAL;
+		usleep(nsec / 1000);
+		Reap();
+	}
+};
+
+#endif
+
+// Asynchronous engine using Linux native AIO (io_submit() and io_getevents()),
+// for kernels on which io_uring is unavailable. Like libaio itself, the system
+// calls are used directly. Native AIO is only truly asynchronous for files
+// opened with O_DIRECT, which also requires aligned buffers, offsets and sizes;
+// otherwise io_submit() blocks until the transaction has completed. As with
+// io_uring, queued control blocks are submitted together with a single
+// io_submit() by Flush(), or when all of them are in use.
+
+class LinuxAIOIOEngine : public IOEngine {
+private :
+	aio_context_t context;
+	struct iocb *iocbs;
+	struct iocb **free_iocbs;	// Stack of unused control blocks.
+	struct iocb **queued_iocbs;	// Control blocks queued but not yet submitted.
+	struct io_event *events;
+	uint64_t *iocb_time;		// Time at which each control block was queued.
+	int nu_free;
+	int nu_queued;
+	int nu_in_flight;
+
+	void Submit() {
+		int nu_submitted = 0;
+		while (nu_submitted < nu_queued) {
+			int r = syscall(__NR_io_submit, context, nu_queued - nu_submitted,
+				&queued_iocbs[nu_submitted]);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN && nu_in_flight > 0) {
+					// Kernel resources are exhausted; make room first.
+					Reap(1);
+					continue;
+				}
+				FatalError("Error during io_submit().\n");
+			}
+			nu_submitted += r;
+			nu_in_flight += r;
+			nu_transactions += r;
+			queue_depth_sum += (uint64_t)nu_in_flight * r;
+		}
+		nu_queued = 0;
+	}
+	// Reap completions, waiting for at least min_complete of them or until the
+	// time-out (if not NULL) has expired.
+	void Reap(int min_complete, struct timespec *timeout = NULL) {
+		int r;
+		do
+			r = syscall(__NR_io_getevents, context, min_complete, queue_depth,
+				events, timeout);
+		while (r < 0 && errno == EINTR && timeout == NULL);
+		if (r < 0 && errno == EINTR)
+			return;
+		if (r < 0)
+			FatalError("Error during io_getevents().\n");
+		uint64_t time = GetTimeStamp();
+		for (int i = 0; i < r; i++) {
+			struct iocb *cb = (struct iocb *)(uintptr_t)events[i].obj;
+			if (events[i].res < 0 || (uint64_t)events[i].res != cb->aio_nbytes)
+				FatalError("Error during asynchronous %s operation.\n",
+					events[i].res < 0 ? "I/O" : "read or write (short transfer)");
+			RecordCompletion(cb->aio_lio_opcode == IOCB_CMD_PWRITE, cb->aio_nbytes,
+				TimeStampToNSec(time - iocb_time[cb - iocbs]));
+			if (write_observer != NULL && cb->aio_lio_opcode == IOCB_CMD_PWRITE)
+				write_observer->WriteCompleted((void *)(uintptr_t)cb->aio_buf,
+					cb->aio_nbytes, cb->aio_offset);
+			free_iocbs[nu_free] = cb;
+			nu_free++;
+		}
+		nu_in_flight -= r;
+	}
+	void Queue(int opcode, void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		while (nu_free == 0) {
+			Submit();
+			Reap(1);
+		}
+		nu_free--;
+		struct iocb *cb = free_iocbs[nu_free];
+		memset(cb, 0, sizeof(struct iocb));
+		cb->aio_lio_opcode = opcode;
+		cb->aio_fildes = fd;
+		cb->aio_buf = (uint64_t)(uintptr_t)buffer;
+		cb->aio_nbytes = size;
+		cb->aio_offset = offset;
+		iocb_time[cb - iocbs] = scheduled_time != 0 ? scheduled_time : GetTimeStamp();
+		queued_iocbs[nu_queued] = cb;
+		nu_queued++;
+	}
+public :
+	LinuxAIOIOEngine(int _queue_depth) {
+		queue_depth = _queue_depth;
+		context = 0;
+		if (syscall(__NR_io_setup, queue_depth, &context) < 0)
+			FatalError("Could not set up Linux native AIO context (aio-max-nr "
+				"exceeded?).\n");
+		iocbs = new struct iocb[queue_depth];
+		free_iocbs = new struct iocb *[queue_depth];
+		queued_iocbs = new struct iocb *[queue_depth];
+		events = new struct io_event[queue_depth];
+		iocb_time = new uint64_t[queue_depth];
+		for (int i = 0; i < queue_depth; i++)
+			free_iocbs[i] = &iocbs[i];
+		nu_free = queue_depth;
+		nu_queued = 0;
+		nu_in_flight = 0;
+	}
+	~LinuxAIOIOEngine() {
+		if (fd >= 0)
+			Close();
+		syscall(__NR_io_destroy, context);
+		delete [] iocbs;
+		delete [] free_iocbs;
+		delete [] queued_iocbs;
+		delete [] events;
+		delete [] iocb_time;
+	}
+	const char *Name() const {
+		return io_engine_name[IO_ENGINE_LIBAIO];
+	}
+	bool IsAsynchronous() const {
+		return true;
+	}
+	bool RequiresDirectAccess() const {
+		return true;
+	}
+	void Close() {
+		Wait();
+		IOEngine::Close();
+	}
+	void Read(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		Queue(IOCB_CMD_PREAD, buffer, size, offset, scheduled_time);
+	}
+	void Write(void *buffer, size_t size, uint64_t offset, uint64_t scheduled_time) {
+		Queue(IOCB_CMD_PWRITE, buffer, size, offset, scheduled_time);
+	}
+	char *GetBuffer() {
+		while (nu_free == 0) {
+			Submit();
+			Reap(1);
+		}
+		// Queue() takes the control block on top of the stack.
+		return buffers->Get(free_iocbs[nu_free - 1] - iocbs);
+	}
+	void Flush() {
+		if (nu_queued > 0)
+			Submit();
+	}
+	void Wait() {
+		Submit();
+		while (nu_in_flight > 0)
+			Reap(1);
+	}
+	void Idle(uint64_t nsec) {
+		Flush();
+		if (nu_in_flight == 0) {
+			usleep(nsec / 1000);
+			return;
+		}
+		struct timespec ts;
+		ts.tv_sec = nsec / 1000000000;
+		ts.tv_nsec = nsec % 1000000000;
+		Reap(nsec == 0 ? 0 : 1, &ts);
+	}
+};
+
+IOEngine *CreateIOEngine(int type, int queue_depth) {
+	switch (type) {
+	case IO_ENGINE_PSYNC :
+		return new PSyncIOEngine;
+	case IO_ENGINE_SYNC :
+		return new SyncIOEngine;
+	case IO_ENGINE_IO_URING :
+#ifdef __NR_io_uring_setup
+		return new IOUringIOEngine(queue_depth);
+#else
+		FatalError("io_uring engine not supported on this system.\n");
+#endif
+	case IO_ENGINE_LIBAIO :
+		return new LinuxAIOIOEngine(queue_depth);
+	}
+	FatalError("Unknown I/O engine.\n");
+}
+
+int LookupIOEngine(const char *name) {
+	for (int i = 0; i < NU_IO_ENGINES; i++)
+		if (strcmp(name, io_engine_name[i]) == 0)
+			return i;
+	return - 1;
+}
+
+const char *GetIOEngineName(int type) {
+	return io_engine_name[type];
+}
@@ -0,0 +1,212 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// I/O engine interface. All benchmark tests and trace replays perform their
+// transactions through an I/O engine, so that the system calls used to access
+// the test file can be selected at run time. Requires buffer-pool.h to be
+// included first.
+
+enum {
+	IO_ENGINE_PSYNC = 0,	// pread()/pwrite(), one system call per transaction.
+	IO_ENGINE_SYNC = 1,	// lseek() followed by read()/write().
+	IO_ENGINE_IO_URING = 2,	// Asynchronous I/O using io_uring.
+	IO_ENGINE_LIBAIO = 3,	// Linux native asynchronous I/O (io_submit()).
+	NU_IO_ENGINES
+};
+
+#define DEFAULT_IO_ENGINE IO_ENGINE_PSYNC
+
+// Statistics of a single reporting interval (--report-interval). While a test
+// is running, the worker owning an engine periodically swaps in a fresh object,
+// so that the statistics of the interval that has ended can be read by another
+// thread without locking.
+
+class IntervalStatistics {
+public :
+	uint64_t nu_transactions;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	LatencyHistogram read_latency;
+	LatencyHistogram write_latency;
+
+	void Reset() {
+		nu_transactions = 0;
+		read_bytes = 0;
+		write_bytes = 0;
+		read_latency.Reset();
+		write_latency.Reset();
+	}
+	void Add(const IntervalStatistics *s) {
+		nu_transactions += s->nu_transactions;
+		read_bytes += s->read_bytes;
+		write_bytes += s->write_bytes;
+		read_latency.Add(&s->read_latency);
+		write_latency.Add(&s->write_latency);
+	}
+};
+
+// Receives the completion of every write of an asynchronous engine, in the
+// order in which the engine sees them, with the buffer that was written. The
+// buffer is still intact during the call.
+
+class WriteCompletionObserver {
+public :
+	virtual void WriteCompleted(const void *buffer, size_t size, uint64_t offset) = 0;
+};
+
+// Synchronous engines complete every transaction before returning from Read()
+// or Write(). Asynchronous engines queue the transaction and return without
+// waiting for it to complete, unless all queue_depth slots are in use. Queued
+// transactions are submitted together, with a single system call, by Flush(),
+// which the caller invokes when it stops issuing transactions for a while;
+// Idle() and Wait() flush first, and so does the engine itself when it has to
+// wait for a free slot. The latency of a transaction is measured from the
+// moment it was queued. All outstanding transactions have completed after
+// Wait() or Close() returns. Because transactions may still be in progress,
+// the buffer passed to Read() should not be used by the caller until then.
+
+class IOEngine {
+protected :
+	int fd;
+	int queue_depth;
+	IntervalStatistics *interval;	// NULL when intervals are not reported.
+	BufferPool *buffers;		// One buffer per queue slot.
+	WriteCompletionObserver *write_observer;	// NULL when not set.
+
+	// Record the completion of a transaction of the given size and latency.
+	void RecordCompletion(bool write_transaction, size_t size, uint64_t latency) {
+		if (write_transaction) {
+			write_latency.Record(latency);
+			write_bytes += size;
+		}
+		else {
+			read_latency.Record(latency);
+			read_bytes += size;
+		}
+		if (interval == NULL)
+			return;
+		interval->nu_transactions++;
+		if (write_transaction) {
+			interval->write_latency.Record(latency);
+			interval->write_bytes += size;
+		}
+		else {
+			interval->read_latency.Record(latency);
+			interval->read_bytes += size;
+		}
+	}
+public :
+	// Statistics since the last call to ResetStatistics(). For every transaction,
+	// the number of transactions in flight at the moment it was submitted
+	// (including itself) is added to queue_depth_sum. The latency of each
+	// transaction, from the moment it was queued until its completion was
+	// seen, is recorded in nanoseconds. The number of completed reads and
+	// writes is the count of the respective latency histogram.
+	uint64_t nu_transactions;
+	uint64_t queue_depth_sum;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	LatencyHistogram read_latency;
+	LatencyHistogram write_latency;
+
+	IOEngine();
+	virtual ~IOEngine();
+	virtual const char *Name() const = 0;
+	virtual bool IsAsynchronous() const {
+		return false;
+	}
+	// Whether the engine only operates asynchronously when the file is opened
+	// with O_DIRECT.
+	virtual bool RequiresDirectAccess() const {
+		return false;
+	}
+	int GetQueueDepth() const {
+		return queue_depth;
+	}
+	void ResetStatistics() {
+		nu_transactions = 0;
+		queue_depth_sum = 0;
+		read_bytes = 0;
+		write_bytes = 0;
+		read_latency.Reset();
+		write_latency.Reset();
+	}
+	double GetAverageQueueDepth() const {
+		if (nu_transactions == 0)
+			return 0;
+		return (double)queue_depth_sum / nu_transactions;
+	}
+	// Record the statistics of completed transactions in s (which may be NULL)
+	// from now on, and return the object that was previously used.
+	IntervalStatistics *SwapIntervalStatistics(IntervalStatistics *s) {
+		IntervalStatistics *previous = interval;
+		interval = s;
+		return previous;
+	}
+	// Set the buffers returned by GetBuffer(). The pool must have at least as
+	// many buffers as the queue depth.
+	void SetBufferPool(BufferPool *pool) {
+		buffers = pool;
+	}
+	// Report the completions of writes to an observer (NULL for none). Only
+	// applies to asynchronous engines; synchronous engines complete writes in
+	// the order in which they are issued.
+	void SetWriteCompletionObserver(WriteCompletionObserver *observer) {
+		write_observer = observer;
+	}
+	// Return a buffer that is not used by any outstanding transaction, for the
+	// next call to Read() or Write(). Asynchronous engines wait for a queue slot
+	// to become free if necessary, and return the buffer of that slot.
+	virtual char *GetBuffer() {
+		return buffers->Get(0);
+	}
+	// Open the test file with the given open() flags. Exits with an error
+	// if the file cannot be opened.
+	virtual void Open(const char *filename, int flags);
+	virtual void Close();
+	// Read or write size bytes at the given byte offset in the file. When a
+	// scheduled time (a time stamp as returned by GetTimeStamp()) is given, the
+	// latency of the transaction is measured from that time instead of from
+	// the moment it is submitted, so that the delay of a transaction issued
+	// later than scheduled is included.
+	virtual void Read(void *buffer, size_t size, uint64_t offset,
+		uint64_t scheduled_time = 0) = 0;
+	virtual void Write(void *buffer, size_t size, uint64_t offset,
+		uint64_t scheduled_time = 0) = 0;
+	// Submit the transactions that have been queued but not yet submitted.
+	virtual void Flush() { }
+	// Wait until all outstanding transactions have completed.
+	virtual void Wait() { }
+	// Wait for at most nsec nanoseconds while there is nothing to submit.
+	// Queued transactions are submitted first. Asynchronous engines reap the completions of outstanding transactions
+	// meanwhile, as soon as they occur, and may return early when one has
+	// completed; with nsec equal to 0, available completions are reaped without
+	// waiting.
+	virtual void Idle(uint64_t nsec);
+};
+
+// Create an I/O engine. The queue depth is only relevant for asynchronous
+// engines; synchronous engines always have a queue depth of 1.
+
+IOEngine *CreateIOEngine(int type, int queue_depth);
+
+// Return the engine type with the given name, or - 1 if there is none.
+
+int LookupIOEngine(const char *name);
+
+const char *GetIOEngineName(int type);
@@ -0,0 +1,78 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "latency-histogram.h"
+
+LatencyHistogram::LatencyHistogram() {
+	counts = new uint64_t[LATENCY_HISTOGRAM_NU_BUCKETS];
+	Reset();
+}
+
+LatencyHistogram::~LatencyHistogram() {
+	delete [] counts;
+}
+
+void LatencyHistogram::Reset() {
+	memset(counts, 0, sizeof(uint64_t) * LATENCY_HISTOGRAM_NU_BUCKETS);
+	total_count = 0;
+	max_value = 0;
+	sum = 0;
+}
+
+// Return the highest value that maps to the same bucket as all values in the bucket.
+
+uint64_t LatencyHistogram::GetBucketHighestValue(int index) {
+	int shift = (index >> LATENCY_HISTOGRAM_SUB_BUCKET_BITS) - 1;
+	if (shift <= 0)
+		return index;
+	uint64_t sub_bucket = index - (shift << LATENCY_HISTOGRAM_SUB_BUCKET_BITS);
+	return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Add(const LatencyHistogram *h) {
+	for (int i = 0; i < LATENCY_HISTOGRAM_NU_BUCKETS; i++)
+		counts[i] += h->counts[i];
+	total_count += h->total_count;
+	sum += h->sum;
+	if (h->max_value > max_value)
+		max_value = h->max_value;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const {
+	if (total_count == 0)
+		return 0;
+	uint64_t count_at_percentile = (uint64_t)(percentile * 0.01 * total_count + 0.5);
+	if (count_at_percentile < 1)
+		count_at_percentile = 1;
+	uint64_t cumulative_count = 0;
+	for (int i = 0; i < LATENCY_HISTOGRAM_NU_BUCKETS; i++) {
+		cumulative_count += counts[i];
+		if (cumulative_count >= count_at_percentile) {
+			uint64_t value = GetBucketHighestValue(i);
+			// Never report more than the actual maximum.
+			if (value > max_value)
+				value = max_value;
+			return value;
+		}
+	}
+	return max_value;
+}
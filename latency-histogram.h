@@ -0,0 +1,80 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdint.h>
+
+// Log-linear latency histogram, in the style of HdrHistogram. Values (in
+// nanoseconds) below 128 are recorded exactly; larger values are recorded in
+// one of 64 equally sized sub-buckets for every power of two, so that the
+// relative error of any reported value is less than 1/64 (about 1.6%).
+// All memory is allocated by the constructor, so that recording a value is
+// cheap and does not allocate memory.
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 6
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+// Values up to 2^40 ns (about 18 minutes) are recorded; larger values are clamped.
+#define LATENCY_HISTOGRAM_MAX_BITS 40
+#define LATENCY_HISTOGRAM_NU_BUCKETS ((LATENCY_HISTOGRAM_MAX_BITS - \
+	LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+class LatencyHistogram {
+private :
+	uint64_t *counts;
+	uint64_t total_count;
+	uint64_t max_value;
+	uint64_t sum;
+
+	static inline int GetBucketIndex(uint64_t value) {
+		if (value >= ((uint64_t)1 << LATENCY_HISTOGRAM_MAX_BITS))
+			value = ((uint64_t)1 << LATENCY_HISTOGRAM_MAX_BITS) - 1;
+		int msb = 63 - __builtin_clzll(value | 1);
+		int shift = msb - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+		if (shift < 0)
+			shift = 0;
+		return (shift << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) + (int)(value >> shift);
+	}
+	static uint64_t GetBucketHighestValue(int index);
+
+public :
+	LatencyHistogram();
+	~LatencyHistogram();
+	void Reset();
+	inline void Record(uint64_t value) {
+		counts[GetBucketIndex(value)]++;
+		total_count++;
+		sum += value;
+		if (value > max_value)
+			max_value = value;
+	}
+	// Add all values recorded in another histogram.
+	void Add(const LatencyHistogram *h);
+	uint64_t GetCount() const {
+		return total_count;
+	}
+	uint64_t GetMax() const {
+		return max_value;
+	}
+	double GetMean() const {
+		if (total_count == 0)
+			return 0;
+		return (double)sum / total_count;
+	}
+	// Return the value below or at which the given percentage of recorded
+	// values lies.
+	uint64_t GetPercentile(double percentile) const;
+};
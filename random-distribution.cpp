@@ -0,0 +1,137 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "random-distribution.h"
+
+// The zipf distribution is sampled with the rejection-inversion method of
+// Hoermann and Derflinger ("Rejection-inversion to generate variates from
+// monotone discrete distributions", 1996), which requires no table and no
+// calculation of the generalized harmonic number of the range, and works for
+// any positive exponent. Values are generated in the range 1 to size.
+
+// Return log(1 + x) / x, also for values of x close to zero.
+
+static double Helper1(double x) {
+	if (fabs(x) > 1E-8)
+		return log1p(x) / x;
+	return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+// Return (exp(x) - 1) / x, also for values of x close to zero.
+
+static double Helper2(double x) {
+	if (fabs(x) > 1E-8)
+		return expm1(x) / x;
+	return 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+}
+
+double AccessDistribution::ZipfH(double x) const {
+	return exp(- parameter * log(x));
+}
+
+double AccessDistribution::ZipfHIntegral(double x) const {
+	double log_x = log(x);
+	return Helper2((1.0 - parameter) * log_x) * log_x;
+}
+
+double AccessDistribution::ZipfHIntegralInverse(double x) const {
+	double t = x * (1.0 - parameter);
+	if (t < - 1.0)
+		t = - 1.0;
+	return exp(Helper1(t) * x);
+}
+
+uint64_t AccessDistribution::SampleZipf(RandomGenerator *rng) const {
+	for (;;) {
+		double u = zipf_h_integral_n + rng->NextDouble() *
+			(zipf_h_integral_x1 - zipf_h_integral_n);
+		double x = ZipfHIntegralInverse(u);
+		double k = floor(x + 0.5);
+		if (k < 1.0)
+			k = 1.0;
+		else if (k > (double)size)
+			k = (double)size;
+		if (k - x <= zipf_s || u >= ZipfHIntegral(k + 0.5) - ZipfH(k)) {
+			uint64_t rank = (uint64_t)k - 1;
+			// Guard against rounding at the end of very large ranges.
+			return rank < size ? rank : size - 1;
+		}
+	}
+}
+
+void AccessDistribution::Init(int _type, uint64_t _size, double _parameter, double _parameter2) {
+	type = _type;
+	size = _size;
+	parameter = _parameter;
+	parameter2 = _parameter2;
+	if (size == 0)
+		return;
+	switch (type) {
+	case DISTRIBUTION_ZIPF :
+		zipf_h_integral_x1 = ZipfHIntegral(1.5) - 1.0;
+		zipf_h_integral_n = ZipfHIntegral((double)size + 0.5);
+		zipf_s = 2.0 - ZipfHIntegralInverse(ZipfHIntegral(2.5) - ZipfH(2.0));
+		break;
+	case DISTRIBUTION_PARETO :
+		pareto_exponent = parameter / (parameter - 1.0);
+		break;
+	case DISTRIBUTION_HOT_COLD :
+		hot_size = (uint64_t)((double)size * parameter2 * 0.01);
+		if (hot_size < 1)
+			hot_size = 1;
+		if (hot_size > size)
+			hot_size = size;
+		break;
+	}
+}
+
+uint64_t AccessDistribution::Sample(RandomGenerator *rng) const {
+	switch (type) {
+	case DISTRIBUTION_ZIPF :
+		return SampleZipf(rng);
+	case DISTRIBUTION_PARETO : {
+		// When the popularity of the blocks follows a Pareto distribution with
+		// shape a, the most popular fraction p of the blocks receives a fraction
+		// p ^ (1 - 1 / a) of the accesses (the Lorenz curve). Inverting this
+		// gives the relative rank of the block of a random access.
+		uint64_t rank = (uint64_t)(pow(rng->NextDouble(), pareto_exponent) * (double)size);
+		return rank < size ? rank : size - 1;
+		}
+	case DISTRIBUTION_NORMAL : {
+		double mean = (double)size * 0.5;
+		double stddev = (double)size * parameter * 0.01;
+		for (;;) {
+			// Box-Muller transform; values outside the range are rejected.
+			double u1 = 1.0 - rng->NextDouble();
+			double u2 = rng->NextDouble();
+			double x = mean + stddev * sqrt(- 2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+			if (x >= 0 && x < (double)size)
+				return (uint64_t)x;
+		}
+		}
+	case DISTRIBUTION_HOT_COLD :
+		if (hot_size == size || rng->NextDouble() * 100.0 < parameter)
+			return rng->NextBelow(hot_size);
+		return hot_size + rng->NextBelow(size - hot_size);
+	}
+	return rng->NextBelow(size);
+}
@@ -0,0 +1,105 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Pseudo-random number generation and the skewed access distributions of the
+// zipf, pareto, normal and hot/cold random access tests.
+
+// Fast pseudo-random number generator (SplitMix64). Every worker has its own
+// generator, so that no state is shared between threads.
+
+class RandomGenerator {
+private :
+	uint64_t state;
+
+public :
+	void Seed(uint64_t seed) {
+		state = seed;
+	}
+	inline uint64_t Next() {
+		state += 0x9E3779B97F4A7C15ULL;
+		uint64_t x = state;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+	// Return a uniformly distributed value in [0, 1).
+	inline double NextDouble() {
+		return (double)(Next() >> 11) * (1.0d / 9007199254740992.0d);
+	}
+	// Return a uniformly distributed integer in [0, n).
+	inline uint64_t NextBelow(uint64_t n) {
+		return (uint64_t)(((unsigned __int128)Next() * n) >> 64);
+	}
+};
+
+enum {
+	DISTRIBUTION_UNIFORM = 0,
+	DISTRIBUTION_ZIPF = 1,		// Zipf's law with exponent theta.
+	DISTRIBUTION_PARETO = 2,	// Pareto distribution of popularity with the given shape.
+	DISTRIBUTION_NORMAL = 3,	// Normal distribution around the middle of the range.
+	DISTRIBUTION_HOT_COLD = 4,	// A fixed fraction of accesses to a hot region.
+	NU_DISTRIBUTIONS
+};
+
+// Distribution of block indices in the range 0 to size - 1. All set-up is
+// done by Init(), which takes constant time, so that the distribution can be
+// used for ranges of any size. Sample() only reads the distribution object,
+// which can therefore be shared by multiple threads.
+//
+// For the zipf and pareto distributions, the value drawn is the popularity
+// rank of a block; ranks are scattered over the range by a random permutation
+// (supplied by the caller), so that the hot blocks are not adjacent. The
+// normal and hot/cold distributions describe actual locations: the hot region
+// is in the middle of the range for the normal distribution and at the start
+// of the range for the hot/cold distribution.
+
+class AccessDistribution {
+private :
+	int type;
+	uint64_t size;
+	double parameter;
+	double parameter2;
+	// Precalculated values.
+	double zipf_h_integral_x1;
+	double zipf_h_integral_n;
+	double zipf_s;
+	double pareto_exponent;
+	uint64_t hot_size;
+
+	double ZipfH(double x) const;
+	double ZipfHIntegral(double x) const;
+	double ZipfHIntegralInverse(double x) const;
+	uint64_t SampleZipf(RandomGenerator *rng) const;
+
+public :
+	// Set up a distribution. The meaning of the parameters depends on the type:
+	// the exponent for zipf, the shape (greater than 1) for pareto, the
+	// standard deviation as a percentage of the range for normal, and the
+	// percentage of accesses and the percentage of the range of the hot region
+	// for hot/cold. A distribution of size 0 is left unset, and must not be
+	// sampled.
+	void Init(int _type, uint64_t _size, double _parameter, double _parameter2);
+	int GetType() const {
+		return type;
+	}
+	// Whether the values drawn are popularity ranks rather than locations.
+	bool IsRanked() const {
+		return type == DISTRIBUTION_ZIPF || type == DISTRIBUTION_PARETO;
+	}
+	uint64_t Sample(RandomGenerator *rng) const;
+};
@@ -0,0 +1,32 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdint.h>
+
+#include "random-permutation.h"
+
+void RandomPermutation::Init(uint64_t _size, uint64_t seed) {
+	size = _size;
+	half_bits = 0;
+	while (half_bits < 32 && ((uint64_t)1 << (half_bits * 2)) < size)
+		half_bits++;
+	half_mask = ((uint64_t)1 << half_bits) - 1;
+	// Derive the round keys from the seed.
+	for (int i = 0; i < RANDOM_PERMUTATION_ROUNDS; i++)
+		key[i] = Mix(seed + (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL);
+}
@@ -0,0 +1,76 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Pseudo-random permutation of the integers 0 to size - 1, used for the block
+// order of random access tests. Instead of storing a shuffled array, every
+// element is computed on demand, so that the permutation takes no memory and
+// needs no set-up time regardless of the size of the range.
+//
+// The permutation is a keyed Feistel network on the smallest domain of 2^(2k)
+// values that contains all indices. Being a Feistel network, it is a bijection
+// on that domain; values outside the range are mapped again until a value
+// inside the range results ("cycle walking"), which preserves the bijection.
+// Because the domain is less than four times the range, fewer than four
+// iterations are required on average.
+
+#define RANDOM_PERMUTATION_ROUNDS 6
+
+class RandomPermutation {
+private :
+	uint64_t size;
+	int half_bits;
+	uint64_t half_mask;
+	uint64_t key[RANDOM_PERMUTATION_ROUNDS];
+
+	// Bit mixing function (the finalizer of SplitMix64).
+	static inline uint64_t Mix(uint64_t x) {
+		x ^= x >> 30;
+		x *= 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 27;
+		x *= 0x94D049BB133111EBULL;
+		x ^= x >> 31;
+		return x;
+	}
+	inline uint64_t Encrypt(uint64_t x) const {
+		uint64_t left = x >> half_bits;
+		uint64_t right = x & half_mask;
+		for (int i = 0; i < RANDOM_PERMUTATION_ROUNDS; i++) {
+			uint64_t new_right = left ^ (Mix(right ^ key[i]) & half_mask);
+			left = right;
+			right = new_right;
+		}
+		return (left << half_bits) | right;
+	}
+
+public :
+	// Set up the permutation of the given size. Permutations with the same
+	// size and seed are identical.
+	void Init(uint64_t _size, uint64_t seed);
+	uint64_t GetSize() const {
+		return size;
+	}
+	// Return element i (0 <= i < size) of the permutation. The size must not be
+	// 0, or the cycle walk never ends.
+	inline uint64_t Get(uint64_t i) const {
+		uint64_t x = i;
+		do
+			x = Encrypt(x);
+		while (x >= size);
+		return x;
+	}
+};
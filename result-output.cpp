@@ -0,0 +1,240 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "latency-histogram.h"
+#include "result-output.h"
+
+const double reported_percentile[NU_REPORTED_PERCENTILES] = { 50, 90, 99, 99.9, 99.99 };
+
+static const char *output_format_name[] = { "text", "json", "csv" };
+
+static int output_format = OUTPUT_FORMAT_TEXT;
+static FILE *output_file;
+static int nu_records;
+
+void LatencySummary::Set(const LatencyHistogram *h) {
+	count = h->GetCount();
+	mean = h->GetMean();
+	for (int i = 0; i < NU_REPORTED_PERCENTILES; i++)
+		percentile[i] = h->GetPercentile(reported_percentile[i]);
+	max = h->GetMax();
+}
+
+int LookupOutputFormat(const char *name) {
+	for (int i = 0; i < 3; i++)
+		if (strcmp(name, output_format_name[i]) == 0)
+			return i;
+	return - 1;
+}
+
+// Write a string as a JSON string literal.
+
+static void OutputJSONString(const char *s) {
+	if (s == NULL) {
+		fputs("null", output_file);
+		return;
+	}
+	fputc('"', output_file);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(output_file, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(output_file, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, output_file);
+	}
+	fputc('"', output_file);
+}
+
+// Write a string as a CSV field, quoted if necessary.
+
+static void OutputCSVString(const char *s) {
+	if (s == NULL)
+		return;
+	if (strpbrk(s, ",\"\n") == NULL) {
+		fputs(s, output_file);
+		return;
+	}
+	fputc('"', output_file);
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			fputc('"', output_file);
+		fputc(*s, output_file);
+	}
+	fputc('"', output_file);
+}
+
+static const char *GetRecordType(const TestResult *r) {
+	if (r->stream >= 0)
+		return "stream";
+	if (r->interval)
+		return "interval";
+	return "test";
+}
+
+static void OutputJSONLatency(const char *name, const LatencySummary *l) {
+	fprintf(output_file, ", \"%s\": ", name);
+	if (l->count == 0) {
+		fputs("null", output_file);
+		return;
+	}
+	fprintf(output_file, "{ \"count\": %llu, \"avg\": %.3lf", (unsigned long long)l->count,
+		l->mean * 0.001);
+	for (int i = 0; i < NU_REPORTED_PERCENTILES; i++)
+		fprintf(output_file, ", \"p%g\": %.3lf", reported_percentile[i],
+			l->percentile[i] * 0.001);
+	fprintf(output_file, ", \"max\": %.3lf }", l->max * 0.001);
+}
+
+static void OutputCSVLatencyHeader(const char *name) {
+	fprintf(output_file, ",%s_count,%s_avg_us", name, name);
+	for (int i = 0; i < NU_REPORTED_PERCENTILES; i++)
+		fprintf(output_file, ",%s_p%g_us", name, reported_percentile[i]);
+	fprintf(output_file, ",%s_max_us", name);
+}
+
+static void OutputCSVLatency(const LatencySummary *l) {
+	if (l->count == 0) {
+		// Leave all fields empty.
+		for (int i = 0; i < NU_REPORTED_PERCENTILES + 3; i++)
+			fputc(',', output_file);
+		return;
+	}
+	fprintf(output_file, ",%llu,%.3lf", (unsigned long long)l->count, l->mean * 0.001);
+	for (int i = 0; i < NU_REPORTED_PERCENTILES; i++)
+		fprintf(output_file, ",%.3lf", l->percentile[i] * 0.001);
+	fprintf(output_file, ",%.3lf", l->max * 0.001);
+}
+
+void BeginOutput(int format, FILE *f) {
+	output_format = format;
+	output_file = f;
+	nu_records = 0;
+	if (output_format == OUTPUT_FORMAT_JSON)
+		fputs("[\n", output_file);
+	else if (output_format == OUTPUT_FORMAT_CSV) {
+		fputs("type,time_s,stream,test,trace,distribution,rwmix_read,target_iops,engine,iodepth,threads,direct,"
+			"sync,block_size,range,bytes,transactions,elapsed_s,bandwidth_MBps,iops,"
+			"read_bandwidth_MBps,read_iops,write_bandwidth_MBps,write_iops,average_qd,"
+			"cpu_user_pct,cpu_sys_pct", output_file);
+		OutputCSVLatencyHeader("read_latency");
+		OutputCSVLatencyHeader("write_latency");
+		OutputCSVLatencyHeader("replay_lag");
+		fputc('\n', output_file);
+	}
+}
+
+void OutputTestResult(const TestResult *r) {
+	if (output_format == OUTPUT_FORMAT_JSON) {
+		if (nu_records > 0)
+			fputs(",\n", output_file);
+		fprintf(output_file, "  { \"type\": \"%s\", \"time_s\": %.6lf, ",
+			GetRecordType(r), r->time);
+		if (r->stream >= 0)
+			fprintf(output_file, "\"stream\": %d, \"test\": ", r->stream);
+		else
+			fputs("\"stream\": null, \"test\": ", output_file);
+		OutputJSONString(r->test_name);
+		fputs(", \"trace\": ", output_file);
+		OutputJSONString(r->trace_filename);
+		fputs(", \"distribution\": ", output_file);
+		OutputJSONString(r->distribution);
+		if (r->rwmix_read >= 0)
+			fprintf(output_file, ", \"rwmix_read\": %g", r->rwmix_read);
+		else
+			fputs(", \"rwmix_read\": null", output_file);
+		if (r->target_iops > 0)
+			fprintf(output_file, ", \"target_iops\": %.1lf", r->target_iops);
+		else
+			fputs(", \"target_iops\": null", output_file);
+		fputs(", \"engine\": ", output_file);
+		OutputJSONString(r->engine_name);
+		fprintf(output_file, ", \"iodepth\": %d, \"threads\": %d, \"direct\": %s, "
+			"\"sync\": %s, \"block_size\": %d, \"range\": %lld, \"bytes\": %lld, "
+			"\"transactions\": %llu, \"elapsed_s\": %.6lf, \"bandwidth_MBps\": %.3lf, "
+			"\"iops\": %.1lf, \"read_bandwidth_MBps\": %.3lf, \"read_iops\": %.1lf, "
+			"\"write_bandwidth_MBps\": %.3lf, \"write_iops\": %.1lf",
+			r->io_depth, r->nu_threads, r->direct ? "true" : "false",
+			r->sync ? "true" : "false", r->block_size, (long long)r->range,
+			(long long)r->bytes_processed, (unsigned long long)r->nu_transactions,
+			r->elapsed_time, r->bandwidth_MB, r->iops, r->read_bandwidth_MB, r->read_iops,
+			r->write_bandwidth_MB, r->write_iops);
+		if (r->interval || r->stream >= 0)
+			fputs(", \"average_qd\": null, \"cpu_user_pct\": null, \"cpu_sys_pct\": null",
+				output_file);
+		else
+			fprintf(output_file, ", \"average_qd\": %.2lf, \"cpu_user_pct\": %.2lf, "
+				"\"cpu_sys_pct\": %.2lf", r->queue_depth, r->ucpu, r->scpu);
+		OutputJSONLatency("read_latency_us", &r->read_latency);
+		OutputJSONLatency("write_latency_us", &r->write_latency);
+		OutputJSONLatency("replay_lag_us", &r->replay_lag);
+		fputs(" }", output_file);
+	}
+	else if (output_format == OUTPUT_FORMAT_CSV) {
+		fprintf(output_file, "%s,%.6lf,", GetRecordType(r), r->time);
+		if (r->stream >= 0)
+			fprintf(output_file, "%d", r->stream);
+		fputc(',', output_file);
+		OutputCSVString(r->test_name);
+		fputc(',', output_file);
+		OutputCSVString(r->trace_filename);
+		fputc(',', output_file);
+		OutputCSVString(r->distribution);
+		fputc(',', output_file);
+		if (r->rwmix_read >= 0)
+			fprintf(output_file, "%g", r->rwmix_read);
+		fputc(',', output_file);
+		if (r->target_iops > 0)
+			fprintf(output_file, "%.1lf", r->target_iops);
+		fputc(',', output_file);
+		OutputCSVString(r->engine_name);
+		fprintf(output_file, ",%d,%d,%d,%d,%d,%lld,%lld,%llu,%.6lf,%.3lf,%.1lf,%.3lf,%.1lf,"
+			"%.3lf,%.1lf",
+			r->io_depth, r->nu_threads, r->direct ? 1 : 0, r->sync ? 1 : 0, r->block_size,
+			(long long)r->range, (long long)r->bytes_processed,
+			(unsigned long long)r->nu_transactions, r->elapsed_time, r->bandwidth_MB,
+			r->iops, r->read_bandwidth_MB, r->read_iops, r->write_bandwidth_MB,
+			r->write_iops);
+		if (r->interval || r->stream >= 0)
+			fputs(",,,", output_file);
+		else
+			fprintf(output_file, ",%.2lf,%.2lf,%.2lf", r->queue_depth, r->ucpu, r->scpu);
+		OutputCSVLatency(&r->read_latency);
+		OutputCSVLatency(&r->write_latency);
+		OutputCSVLatency(&r->replay_lag);
+		fputc('\n', output_file);
+	}
+	else
+		return;
+	nu_records++;
+	fflush(output_file);
+}
+
+void EndOutput() {
+	if (output_format == OUTPUT_FORMAT_JSON)
+		fputs(nu_records > 0 ? "\n]\n" : "]\n", output_file);
+	if (output_format != OUTPUT_FORMAT_TEXT && output_file != stdout)
+		fclose(output_file);
+	else if (output_format != OUTPUT_FORMAT_TEXT)
+		fflush(output_file);
+}
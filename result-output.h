@@ -0,0 +1,94 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Structured (machine-readable) output of benchmark results. Requires
+// latency-histogram.h to be included first.
+
+enum { OUTPUT_FORMAT_TEXT = 0, OUTPUT_FORMAT_JSON = 1, OUTPUT_FORMAT_CSV = 2 };
+
+// Latency percentiles reported for every test.
+
+#define NU_REPORTED_PERCENTILES 5
+
+extern const double reported_percentile[NU_REPORTED_PERCENTILES];
+
+// Summary of a latency histogram, in nanoseconds.
+
+class LatencySummary {
+public :
+	uint64_t count;
+	double mean;
+	uint64_t percentile[NU_REPORTED_PERCENTILES];
+	uint64_t max;
+
+	void Set(const LatencyHistogram *h);
+};
+
+// The parameters and results of a single benchmark test, of a single interval
+// of a test when intervals are reported (--report-interval), or of a single
+// stream of a trace replay. For intervals and streams, the queue depth, CPU
+// usage and combined p99 latency are not measured, and neither are the
+// latencies of streams.
+
+class TestResult {
+public :
+	bool interval;
+	int stream;			// Stream of a trace replay, - 1 for tests and intervals.
+	double time;			// End of the interval (or test) since the start of the test.
+	const char *test_name;
+	const char *trace_filename;	// NULL when the test is not a trace replay.
+	const char *distribution;	// NULL unless the test uses a skewed distribution.
+	double rwmix_read;		// Percentage of reads of a mixed test, - 1 otherwise.
+	double target_iops;		// Target rate of an open-loop test, 0 otherwise.
+	const char *engine_name;
+	int io_depth;
+	int nu_threads;
+	bool direct;
+	bool sync;
+	int block_size;			// 0 for trace replays.
+	int64_t range;
+	int64_t bytes_processed;
+	uint64_t nu_transactions;
+	double elapsed_time;
+	double bandwidth_MB;
+	double iops;
+	double read_bandwidth_MB;
+	double write_bandwidth_MB;
+	double read_iops;
+	double write_iops;
+	double queue_depth;
+	double ucpu;
+	double scpu;
+	LatencySummary read_latency;
+	LatencySummary write_latency;
+	uint64_t latency_p99;		// Over reads and writes combined.
+	LatencySummary replay_lag;	// Of timed trace records (count 0 if none).
+};
+
+// Return the output format with the given name, or - 1 if there is none.
+
+int LookupOutputFormat(const char *name);
+
+// Start writing structured output in the given format to the given file.
+// Nothing is written for OUTPUT_FORMAT_TEXT.
+
+void BeginOutput(int format, FILE *f);
+
+void OutputTestResult(const TestResult *result);
+
+void EndOutput();
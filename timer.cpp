@@ -0,0 +1,77 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "timer.h"
+
+bool tsc_time_stamps = false;
+double tsc_nsec_per_tick = 1.0;
+
+bool EnableTSCTimeStamps() {
+#if defined(__x86_64__) || defined(__i386__)
+	// The time stamp counter must run at a constant rate regardless of frequency
+	// scaling and sleep states (invariant TSC, CPUID 0x80000007 EDX bit 8).
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+		return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	if ((edx & (1 << 8)) == 0)
+		return false;
+	// Calibrate against the system clock over a period of 100 ms.
+	uint64_t start_time = GetCurrentTimeNSec();
+	uint64_t start_tsc = __builtin_ia32_rdtsc();
+	usleep(100000);
+	uint64_t end_time = GetCurrentTimeNSec();
+	uint64_t end_tsc = __builtin_ia32_rdtsc();
+	if (end_tsc <= start_tsc)
+		return false;
+	tsc_nsec_per_tick = (double)(end_time - start_time) / (end_tsc - start_tsc);
+	tsc_time_stamps = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64_t GetTimerResolution() {
+	struct timespec ts;
+	clock_getres(TIMER_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double MeasureTimeStampOverhead() {
+	const int nu_calls = 100000;
+	uint64_t start_time = GetCurrentTimeNSec();
+	uint64_t time_stamp = 0;
+	for (int i = 0; i < nu_calls; i++)
+		time_stamp += GetTimeStamp();
+	uint64_t end_time = GetCurrentTimeNSec();
+	// Prevent the loop from being optimized away.
+	if (time_stamp == 0)
+		return 0;
+	return (double)(end_time - start_time) / nu_calls;
+}
@@ -16,20 +16,81 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 */
 
-// Return current system time/date in cumulative microseconds
+#ifdef CLOCK_MONOTONIC_RAW
+#define TIMER_CLOCK CLOCK_MONOTONIC_RAW
+#define TIMER_CLOCK_NAME "CLOCK_MONOTONIC_RAW"
+#else
+#define TIMER_CLOCK CLOCK_MONOTONIC
+#define TIMER_CLOCK_NAME "CLOCK_MONOTONIC"
+#endif
+
+// Return the current time in nanoseconds. The clock is monotonic and not
+// affected by NTP adjustments; its starting point is unspecified, so only
+// differences between two time values are meaningful.
+
+inline uint64_t GetCurrentTimeNSec() {
+	struct timespec ts;
+	clock_gettime(TIMER_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Return the current time in cumulative microseconds.
 
 inline uint64_t GetCurrentTimeUSec() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000 + tv.tv_usec;
+	return GetCurrentTimeNSec() / 1000;
 }
 
-// Return current system time/date in seconds (double floating point format)
+// Return the current time in seconds (double floating point format).
 
 inline double GetCurrentTime() {
-    return (double)GetCurrentTimeUSec() * 0.000001d;
+	return (double)GetCurrentTimeNSec() * 0.000000001d;
+}
+
+// Fast time stamps, used to measure the latency of individual transactions.
+// By default these are equal to GetCurrentTimeNSec(). When EnableTSCTimeStamps()
+// succeeds, the x86 time stamp counter is read directly instead, avoiding the
+// overhead of clock_gettime(); TimeStampToNSec() converts the difference
+// between two time stamps to nanoseconds.
+
+extern bool tsc_time_stamps;
+extern double tsc_nsec_per_tick;
+
+inline uint64_t GetTimeStamp() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (tsc_time_stamps)
+		return __builtin_ia32_rdtsc();
+#endif
+	return GetCurrentTimeNSec();
+}
+
+inline uint64_t TimeStampToNSec(uint64_t time_stamp_difference) {
+	if (tsc_time_stamps)
+		return (uint64_t)((double)time_stamp_difference * tsc_nsec_per_tick);
+	return time_stamp_difference;
+}
+
+// Convert a duration in nanoseconds to a time stamp difference.
+
+inline double NSecToTimeStamp(double nsec) {
+	if (tsc_time_stamps)
+		return nsec / tsc_nsec_per_tick;
+	return nsec;
 }
 
+// Check whether the CPU has an invariant time stamp counter and, if so,
+// calibrate it against the system clock and use it for time stamps. Returns
+// false if the time stamp counter is unsuitable.
+
+bool EnableTSCTimeStamps();
+
+// Return the resolution of the system clock in nanoseconds.
+
+uint64_t GetTimerResolution();
+
+// Measure the average time in nanoseconds taken by GetTimeStamp().
+
+double MeasureTimeStampOverhead();
+
 // Simple time measurement between two moments.
 
 class Timer {
@@ -37,16 +98,19 @@ private :
 	uint64_t start_time;
 public :
 	void Start() {
-		start_time = GetCurrentTimeUSec();
+		start_time = GetCurrentTimeNSec();
 	}
-	uint64_t ElapsedUSec() {
-		uint64_t end_time = GetCurrentTimeUSec();
+	uint64_t ElapsedNSec() {
+		uint64_t end_time = GetCurrentTimeNSec();
 		uint64_t diff_time = end_time - start_time;
 		start_time = end_time;
 		return diff_time;
 	}
+	uint64_t ElapsedUSec() {
+		return ElapsedNSec() / 1000;
+	}
 	double Elapsed() {
-		return (double)ElapsedUSec() * 0.000001d;
+		return (double)ElapsedNSec() * 0.000000001d;
 	}
 };
 
@@ -67,6 +131,7 @@ private :
 		if (usecs > 0)
 			usleep(usecs);
 		*tt->stop_signalled = true;
+		return NULL;
 	}
 public :
 	ThreadedTimeout() {
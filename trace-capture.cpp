@@ -0,0 +1,570 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Trace capture library. When preloaded into an application (LD_PRELOAD), it
+// records the reads and writes that the application performs on a single file
+// or block device into a trace file in the flash-bench trace format, so that
+// the application's I/O can later be replayed with flash-bench. Every
+// transaction is recorded as a timestamped record (format 4), with the time at
+// which it was issued and a stream number identifying the issuing thread.
+//
+// The captured file and the trace file are set with environment variables:
+//
+// FLASH_BENCH_CAPTURE_FILE	The file or block device to capture (required).
+// FLASH_BENCH_CAPTURE_OUTPUT	The trace file to write (default
+//				flash-bench-capture.trace).
+//
+// read(), write(), pread() and pwrite() (and their 64-bit variants) are
+// captured on file descriptors that were opened with open() or openat() (or
+// duplicated from one with dup(), dup2() or dup3()) and refer to the captured
+// file. The location of read() and write() is derived from the file position
+// after the call. Only the process that is started with the library is
+// captured (including programs it replaces itself with using the exec()
+// family of functions, which write the buffered records first), not its child
+// processes.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <alloca.h>
+
+#define CAPTURE_MAX_FDS 65536
+#define CAPTURE_MAX_STREAMS 65536
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+#define CAPTURE_RECORD_SIZE 24
+
+typedef int (*OpenFunc)(const char *, int, ...);
+typedef int (*OpenAtFunc)(int, const char *, int, ...);
+typedef int (*CloseFunc)(int);
+typedef int (*DupFunc)(int);
+typedef int (*Dup2Func)(int, int);
+typedef int (*Dup3Func)(int, int, int);
+typedef ssize_t (*ReadFunc)(int, void *, size_t);
+typedef ssize_t (*WriteFunc)(int, const void *, size_t);
+typedef ssize_t (*PReadFunc)(int, void *, size_t, off_t);
+typedef ssize_t (*PWriteFunc)(int, const void *, size_t, off_t);
+typedef int (*ExecveFunc)(const char *, char *const [], char *const []);
+typedef int (*ExecvFunc)(const char *, char *const []);
+typedef int (*FExecveFunc)(int, char *const [], char *const []);
+
+static OpenFunc real_open;
+static OpenFunc real_open64;
+static OpenAtFunc real_openat;
+static OpenAtFunc real_openat64;
+static CloseFunc real_close;
+static DupFunc real_dup;
+static Dup2Func real_dup2;
+static Dup3Func real_dup3;
+static ReadFunc real_read;
+static WriteFunc real_write;
+static PReadFunc real_pread;
+static PReadFunc real_pread64;
+static PWriteFunc real_pwrite;
+static PWriteFunc real_pwrite64;
+static ExecveFunc real_execve;
+static ExecvFunc real_execv;
+static ExecvFunc real_execvp;
+static ExecveFunc real_execvpe;
+static FExecveFunc real_fexecve;
+
+static bool capture_enabled;
+static const char *capture_filename;
+static int output_fd = - 1;
+static bool captured_fd[CAPTURE_MAX_FDS];
+static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t buffer[CAPTURE_BUFFER_SIZE];
+static int buffer_size;
+static int nu_streams;
+static __thread int thread_stream = - 1;
+// The time at which the transaction in progress in every stream (thread) was
+// issued, or 0 when there is none.
+static uint64_t in_flight_time[CAPTURE_MAX_STREAMS];
+
+static void ResolveFunctions() {
+	real_open = (OpenFunc)dlsym(RTLD_NEXT, "open");
+	real_open64 = (OpenFunc)dlsym(RTLD_NEXT, "open64");
+	real_openat = (OpenAtFunc)dlsym(RTLD_NEXT, "openat");
+	real_openat64 = (OpenAtFunc)dlsym(RTLD_NEXT, "openat64");
+	real_close = (CloseFunc)dlsym(RTLD_NEXT, "close");
+	real_dup = (DupFunc)dlsym(RTLD_NEXT, "dup");
+	real_dup2 = (Dup2Func)dlsym(RTLD_NEXT, "dup2");
+	real_dup3 = (Dup3Func)dlsym(RTLD_NEXT, "dup3");
+	real_read = (ReadFunc)dlsym(RTLD_NEXT, "read");
+	real_write = (WriteFunc)dlsym(RTLD_NEXT, "write");
+	real_pread = (PReadFunc)dlsym(RTLD_NEXT, "pread");
+	real_pread64 = (PReadFunc)dlsym(RTLD_NEXT, "pread64");
+	real_pwrite = (PWriteFunc)dlsym(RTLD_NEXT, "pwrite");
+	real_execve = (ExecveFunc)dlsym(RTLD_NEXT, "execve");
+	real_execv = (ExecvFunc)dlsym(RTLD_NEXT, "execv");
+	real_execvp = (ExecvFunc)dlsym(RTLD_NEXT, "execvp");
+	real_execvpe = (ExecveFunc)dlsym(RTLD_NEXT, "execvpe");
+	real_fexecve = (FExecveFunc)dlsym(RTLD_NEXT, "fexecve");
+	real_pwrite64 = (PWriteFunc)dlsym(RTLD_NEXT, "pwrite64");
+}
+
+// Functions may be called by other libraries before the constructor has run.
+
+static inline void EnsureResolved() {
+	if (real_pwrite64 == NULL)
+		ResolveFunctions();
+}
+
+static inline uint64_t GetRecordTime(const void *record) {
+	uint64_t time;
+	memcpy(&time, (const uint8_t *)record + 16, 8);
+	return time;
+}
+
+static int CompareRecords(const void *p1, const void *p2) {
+	uint64_t time1 = GetRecordTime(p1);
+	uint64_t time2 = GetRecordTime(p2);
+	return time1 < time2 ? - 1 : time1 > time2;
+}
+
+// Write the buffered records in the order of their time stamps. Unless all
+// records are written, records are kept back when a transaction that is still
+// in progress was issued before them, since it will be recorded with an
+// earlier time stamp; if that applies to all records, they are written anyway,
+// so that the buffer does not overflow. Called with the buffer mutex held.
+
+static void FlushBuffer(bool all) {
+	qsort(buffer, buffer_size / CAPTURE_RECORD_SIZE, CAPTURE_RECORD_SIZE, CompareRecords);
+	int size = buffer_size;
+	if (!all) {
+		uint64_t horizon = UINT64_MAX;
+		int n = __atomic_load_n(&nu_streams, __ATOMIC_RELAXED);
+		if (n > CAPTURE_MAX_STREAMS)
+			n = CAPTURE_MAX_STREAMS;
+		for (int i = 0; i < n; i++) {
+			uint64_t time = __atomic_load_n(&in_flight_time[i], __ATOMIC_ACQUIRE);
+			if (time != 0 && time < horizon)
+				horizon = time;
+		}
+		size = 0;
+		while (size < buffer_size && GetRecordTime(buffer + size) < horizon)
+			size += CAPTURE_RECORD_SIZE;
+		if (size == 0)
+			size = buffer_size;
+	}
+	int offset = 0;
+	while (offset < size) {
+		ssize_t n = real_write(output_fd, buffer + offset, size - offset);
+		if (n <= 0)
+			break;
+		offset += n;
+	}
+	memmove(buffer, buffer + size, buffer_size - size);
+	buffer_size -= size;
+}
+
+// Child processes created with fork() do not capture, and do not write the
+// records buffered by the parent.
+
+static void DisableInChild() {
+	capture_enabled = false;
+	buffer_size = 0;
+	pthread_mutex_init(&buffer_mutex, NULL);
+}
+
+static void __attribute__((constructor)) InitializeCapture() {
+	EnsureResolved();
+	capture_filename = getenv("FLASH_BENCH_CAPTURE_FILE");
+	if (capture_filename == NULL)
+		return;
+	// The process ID of the captured process is passed in the environment, so
+	// that child processes (which inherit the environment) are not captured,
+	// while a program started with exec() by the captured process continues
+	// the trace.
+	char pid_string[16];
+	sprintf(pid_string, "%d", (int)getpid());
+	const char *active_pid_string = getenv("FLASH_BENCH_CAPTURE_PID");
+	bool continued = false;
+	if (active_pid_string != NULL) {
+		if (strcmp(active_pid_string, pid_string) != 0)
+			return;
+		continued = true;
+	}
+	const char *output_filename = getenv("FLASH_BENCH_CAPTURE_OUTPUT");
+	if (output_filename == NULL)
+		output_filename = "flash-bench-capture.trace";
+	output_fd = real_open(output_filename, O_WRONLY | O_CREAT |
+		(continued ? O_APPEND : O_TRUNC), 0644);
+	if (output_fd < 0) {
+		fprintf(stderr, "flash-bench-capture: could not create trace file %s.\n",
+			output_filename);
+		return;
+	}
+	setenv("FLASH_BENCH_CAPTURE_PID", pid_string, 1);
+	pthread_atfork(NULL, NULL, DisableInChild);
+	capture_enabled = true;
+}
+
+static void __attribute__((destructor)) FinishCapture() {
+	if (!capture_enabled)
+		return;
+	pthread_mutex_lock(&buffer_mutex);
+	capture_enabled = false;
+	FlushBuffer(true);
+	pthread_mutex_unlock(&buffer_mutex);
+	real_close(output_fd);
+}
+
+// Called before the process replaces itself with another program. The buffered
+// records would be lost, so they are written; the new program continues the
+// trace (see InitializeCapture()). If the exec() fails, capturing simply
+// continues.
+
+static void FlushBeforeExec() {
+	if (!capture_enabled)
+		return;
+	pthread_mutex_lock(&buffer_mutex);
+	FlushBuffer(true);
+	pthread_mutex_unlock(&buffer_mutex);
+}
+
+// Collect the NULL-terminated variable argument list of execl(), execlp() and
+// execle() into argv, which must have room for CountExecArguments() pointers.
+
+static int CountExecArguments(const char *arg, va_list args) {
+	int n = 1;
+	if (arg != NULL)
+		while (va_arg(args, const char *) != NULL)
+			n++;
+	return n + 1;
+}
+
+static void CollectExecArguments(const char *arg, va_list args, char **argv) {
+	int i = 0;
+	argv[i++] = (char *)arg;
+	if (arg != NULL)
+		while ((argv[i++] = va_arg(args, char *)) != NULL);
+}
+
+static inline uint64_t GetTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline bool IsCaptured(int fd) {
+	return capture_enabled && fd >= 0 && fd < CAPTURE_MAX_FDS && captured_fd[fd];
+}
+
+// Start or stop capturing on a newly opened file descriptor, depending on
+// whether it refers to the captured file.
+
+static void CheckOpenedFile(int fd) {
+	if (!capture_enabled || fd < 0 || fd >= CAPTURE_MAX_FDS)
+		return;
+	struct stat sb, capture_sb;
+	bool captured = false;
+	if (fstat(fd, &sb) == 0 && stat(capture_filename, &capture_sb) == 0) {
+		if (S_ISBLK(capture_sb.st_mode))
+			captured = S_ISBLK(sb.st_mode) && sb.st_rdev == capture_sb.st_rdev;
+		else
+			captured = sb.st_dev == capture_sb.st_dev && sb.st_ino == capture_sb.st_ino;
+	}
+	captured_fd[fd] = captured;
+}
+
+// Called when a transaction is issued. Returns its time stamp, which is
+// registered as the issue time of the transaction in progress in the thread's
+// stream until it is recorded.
+
+static uint64_t BeginTransaction() {
+	if (thread_stream < 0)
+		thread_stream = __atomic_fetch_add(&nu_streams, 1, __ATOMIC_RELAXED) &
+			(CAPTURE_MAX_STREAMS - 1);
+	uint64_t time = GetTime();
+	__atomic_store_n(&in_flight_time[thread_stream], time, __ATOMIC_RELEASE);
+	return time;
+}
+
+// Append a timestamped record (trace format 4) for a completed transaction of
+// n bytes (none are recorded when n is not positive), with the time at which
+// it was issued. Records are written in the order of their time stamps, as
+// the format requires, even though transactions may complete in another order.
+
+static void RecordTransaction(bool write, uint64_t location, ssize_t n, uint64_t time) {
+	if (n <= 0) {
+		__atomic_store_n(&in_flight_time[thread_stream], 0, __ATOMIC_RELEASE);
+		return;
+	}
+	uint64_t size = n;
+	uint32_t first_word = 0xD0000000 | ((uint32_t)thread_stream << 12) |
+		(uint32_t)((size >> 32) & 0xFFF);
+	if (write)
+		first_word |= 0x20000000;
+	uint32_t second_word = (uint32_t)size;
+	pthread_mutex_lock(&buffer_mutex);
+	// The transaction is no longer in progress once its record is buffered.
+	__atomic_store_n(&in_flight_time[thread_stream], 0, __ATOMIC_RELEASE);
+	if (!capture_enabled) {
+		pthread_mutex_unlock(&buffer_mutex);
+		return;
+	}
+	if (buffer_size + CAPTURE_RECORD_SIZE > CAPTURE_BUFFER_SIZE)
+		FlushBuffer(false);
+	uint8_t *p = buffer + buffer_size;
+	memcpy(p, &first_word, 4);
+	memcpy(p + 4, &second_word, 4);
+	memcpy(p + 8, &location, 8);
+	memcpy(p + 16, &time, 8);
+	buffer_size += CAPTURE_RECORD_SIZE;
+	pthread_mutex_unlock(&buffer_mutex);
+}
+
+// Record a read() or write() that transferred n bytes, ending at the current
+// file position.
+
+static void RecordSequentialTransaction(int fd, bool write, ssize_t n, uint64_t time) {
+	off_t position = 0;
+	if (n > 0)
+		position = lseek(fd, 0, SEEK_CUR);
+	if (position < n)
+		n = 0;
+	RecordTransaction(write, position - n, n, time);
+}
+
+extern "C" {
+
+int open(const char *pathname, int flags, ...) {
+	EnsureResolved();
+	mode_t mode = 0;
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	int fd = real_open(pathname, flags, mode);
+	CheckOpenedFile(fd);
+	return fd;
+}
+
+int open64(const char *pathname, int flags, ...) {
+	EnsureResolved();
+	mode_t mode = 0;
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	int fd = real_open64(pathname, flags, mode);
+	CheckOpenedFile(fd);
+	return fd;
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...) {
+	EnsureResolved();
+	mode_t mode = 0;
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	int fd = real_openat(dirfd, pathname, flags, mode);
+	CheckOpenedFile(fd);
+	return fd;
+}
+
+int openat64(int dirfd, const char *pathname, int flags, ...) {
+	EnsureResolved();
+	mode_t mode = 0;
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	int fd = real_openat64(dirfd, pathname, flags, mode);
+	CheckOpenedFile(fd);
+	return fd;
+}
+
+int dup(int oldfd) {
+	EnsureResolved();
+	int fd = real_dup(oldfd);
+	if (fd >= 0 && fd < CAPTURE_MAX_FDS)
+		captured_fd[fd] = IsCaptured(oldfd);
+	return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+	EnsureResolved();
+	int fd = real_dup2(oldfd, newfd);
+	if (fd >= 0 && fd < CAPTURE_MAX_FDS)
+		captured_fd[fd] = IsCaptured(oldfd);
+	return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+	EnsureResolved();
+	int fd = real_dup3(oldfd, newfd, flags);
+	if (fd >= 0 && fd < CAPTURE_MAX_FDS)
+		captured_fd[fd] = IsCaptured(oldfd);
+	return fd;
+}
+
+int close(int fd) {
+	EnsureResolved();
+	if (fd >= 0 && fd < CAPTURE_MAX_FDS)
+		captured_fd[fd] = false;
+	return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_read(fd, buf, count);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_read(fd, buf, count);
+	RecordSequentialTransaction(fd, false, n, time);
+	return n;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_write(fd, buf, count);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_write(fd, buf, count);
+	RecordSequentialTransaction(fd, true, n, time);
+	return n;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_pread(fd, buf, count, offset);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_pread(fd, buf, count, offset);
+	RecordTransaction(false, offset, n, time);
+	return n;
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_pread64(fd, buf, count, offset);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_pread64(fd, buf, count, offset);
+	RecordTransaction(false, offset, n, time);
+	return n;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_pwrite(fd, buf, count, offset);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_pwrite(fd, buf, count, offset);
+	RecordTransaction(true, offset, n, time);
+	return n;
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset) {
+	EnsureResolved();
+	if (!IsCaptured(fd))
+		return real_pwrite64(fd, buf, count, offset);
+	uint64_t time = BeginTransaction();
+	ssize_t n = real_pwrite64(fd, buf, count, offset);
+	RecordTransaction(true, offset, n, time);
+	return n;
+}
+
+int execve(const char *pathname, char *const argv[], char *const envp[]) {
+	EnsureResolved();
+	FlushBeforeExec();
+	return real_execve(pathname, argv, envp);
+}
+
+int execv(const char *pathname, char *const argv[]) {
+	EnsureResolved();
+	FlushBeforeExec();
+	return real_execv(pathname, argv);
+}
+
+int execvp(const char *file, char *const argv[]) {
+	EnsureResolved();
+	FlushBeforeExec();
+	return real_execvp(file, argv);
+}
+
+int execvpe(const char *file, char *const argv[], char *const envp[]) {
+	EnsureResolved();
+	FlushBeforeExec();
+	return real_execvpe(file, argv, envp);
+}
+
+int fexecve(int fd, char *const argv[], char *const envp[]) {
+	EnsureResolved();
+	FlushBeforeExec();
+	return real_fexecve(fd, argv, envp);
+}
+
+int execl(const char *pathname, const char *arg, ...) {
+	va_list args;
+	va_start(args, arg);
+	char **argv = (char **)alloca(CountExecArguments(arg, args) * sizeof(char *));
+	va_end(args);
+	va_start(args, arg);
+	CollectExecArguments(arg, args, argv);
+	va_end(args);
+	return execv(pathname, argv);
+}
+
+int execlp(const char *file, const char *arg, ...) {
+	va_list args;
+	va_start(args, arg);
+	char **argv = (char **)alloca(CountExecArguments(arg, args) * sizeof(char *));
+	va_end(args);
+	va_start(args, arg);
+	CollectExecArguments(arg, args, argv);
+	va_end(args);
+	return execvp(file, argv);
+}
+
+int execle(const char *pathname, const char *arg, ...) {
+	va_list args;
+	va_start(args, arg);
+	char **argv = (char **)alloca(CountExecArguments(arg, args) * sizeof(char *));
+	va_end(args);
+	va_start(args, arg);
+	CollectExecArguments(arg, args, argv);
+	// The environment follows the terminating NULL pointer.
+	char *const *envp = va_arg(args, char *const *);
+	va_end(args);
+	return execve(pathname, argv, envp);
+}
+
+}
@@ -0,0 +1,306 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+// Standalone check of the trace decoder, run with "make check". Decodes
+// records of every format directly, and complete trace files with Trace, to
+// verify the splitting of records and the dispatch lists.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flash-bench.h"
+#include "trace-file.h"
+
+static int nu_checks;
+static int nu_failures;
+
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static void Check(bool condition, const char *description, int line) {
+	nu_checks++;
+	if (condition)
+		return;
+	printf("trace-check.cpp:%d: check failed: %s\n", line, description);
+	nu_failures++;
+}
+
+// Messages of the decoder (such as warnings about truncated records) are
+// expected and not shown.
+
+void Message(const char *format, ...) {
+}
+
+void FatalError(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	exit(1);
+}
+
+// Record encoders for the four formats described in the README.
+
+static int EncodeFormat1(uint8_t *data, bool write, uint64_t location, uint64_t size) {
+	uint32_t words[2];
+	words[0] = (write ? 0x40000000 : 0) | (uint32_t)(size / 4096);
+	words[1] = (uint32_t)(location / 4096);
+	memcpy(data, words, 8);
+	return 8;
+}
+
+static int EncodeFormat2(uint8_t *data, bool write, uint64_t location, uint64_t size) {
+	uint32_t words[2];
+	words[0] = 0x80000000 | (write ? 0x20000000 : 0) | (uint32_t)(location / 4096);
+	words[1] = (uint32_t)size;
+	memcpy(data, words, 8);
+	return 8;
+}
+
+static int EncodeFormat3(uint8_t *data, bool write, uint64_t location, uint64_t size) {
+	uint32_t words[2];
+	words[0] = 0xC0000000 | (write ? 0x20000000 : 0) | (uint32_t)(size >> 32);
+	words[1] = (uint32_t)size;
+	memcpy(data, words, 8);
+	memcpy(&data[8], &location, 8);
+	return 16;
+}
+
+static int EncodeFormat4(uint8_t *data, bool write, uint64_t location, uint64_t size,
+int stream, uint64_t time) {
+	uint32_t words[2];
+	words[0] = 0xD0000000 | (write ? 0x20000000 : 0) | (stream << 12) |
+		(uint32_t)(size >> 32);
+	words[1] = (uint32_t)size;
+	memcpy(data, words, 8);
+	memcpy(&data[8], &location, 8);
+	memcpy(&data[16], &time, 8);
+	return 24;
+}
+
+static void CheckRecord(const uint8_t *data, int record_size, bool write, uint64_t location,
+uint64_t size, int stream, uint64_t time, bool timed) {
+	TraceRecord r;
+	CHECK(DecodeTraceRecord(data, record_size, &r) == record_size);
+	CHECK(r.write == write);
+	CHECK(r.location == location);
+	CHECK(r.size == size);
+	CHECK(r.stream == stream);
+	CHECK(r.time == time);
+	CHECK(r.timed == timed);
+	// A record missing its last byte is truncated.
+	CHECK(DecodeTraceRecord(data, record_size - 1, &r) == 0);
+}
+
+static void CheckFormats() {
+	uint8_t data[24];
+	int n = EncodeFormat1(data, true, 0x3FFFFFFFULL * 4096, 0x3FFFFFFFULL * 4096);
+	CheckRecord(data, n, true, 0x3FFFFFFFULL * 4096, 0x3FFFFFFFULL * 4096, 0, 0, false);
+	n = EncodeFormat1(data, false, 4096, 0);
+	CheckRecord(data, n, false, 4096, 0, 0, 0, false);
+	n = EncodeFormat2(data, true, 0x1FFFFFFFULL * 4096, 0xFFFFFFFF);
+	CheckRecord(data, n, true, 0x1FFFFFFFULL * 4096, 0xFFFFFFFF, 0, 0, false);
+	n = EncodeFormat2(data, false, 8192, 512);
+	CheckRecord(data, n, false, 8192, 512, 0, 0, false);
+	// 64-bit locations and sizes.
+	n = EncodeFormat3(data, true, 0xFEDCBA9876543210ULL, 0x0FFFFFFF00000001ULL);
+	CheckRecord(data, n, true, 0xFEDCBA9876543210ULL, 0x0FFFFFFF00000001ULL, 0, 0, false);
+	n = EncodeFormat3(data, false, 0x123456789ABULL, 100);
+	CheckRecord(data, n, false, 0x123456789ABULL, 100, 0, 0, false);
+	n = EncodeFormat4(data, true, 0xFFFFFFFFFFFFF000ULL, 0xFFFFFFFFFFFULL, 0xFFFF,
+		0x8000000000000000ULL);
+	CheckRecord(data, n, true, 0xFFFFFFFFFFFFF000ULL, 0xFFFFFFFFFFFULL, 0xFFFF,
+		0x8000000000000000ULL, true);
+	n = EncodeFormat4(data, false, 1, 4095, 1, 0);
+	CheckRecord(data, n, false, 1, 4095, 1, 0, true);
+	TraceRecord r;
+	CHECK(DecodeTraceRecord(data, 0, &r) == 0);
+}
+
+static char filename[256];
+
+static void WriteTrace(const uint8_t *data, int size) {
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL || fwrite(data, 1, size, f) != (size_t)size || fclose(f) != 0)
+		FatalError("Could not write %s.\n", filename);
+}
+
+// Check that the decoded records of a trace are valid pieces (see trace-file.h)
+// that cover the trace records exactly, and return the number of trace records.
+
+static uint64_t CheckPieces(Trace *trace) {
+	uint64_t nu_trace_records = 0;
+	uint64_t end = 0;
+	for (uint64_t i = 0; i < trace->nu_records; i++) {
+		uint32_t size = trace->size_flags[i] & TRACE_RECORD_SIZE_MASK;
+		uint64_t location = trace->location[i];
+		if (trace->size_flags[i] & TRACE_RECORD_CONTINUED) {
+			CHECK(i > 0);
+			CHECK(location == end);
+			CHECK((trace->size_flags[i] & ~TRACE_RECORD_SIZE_MASK) ==
+				((trace->size_flags[i - 1] & ~TRACE_RECORD_SIZE_MASK) |
+				TRACE_RECORD_CONTINUED));
+		}
+		else
+			nu_trace_records++;
+		CHECK(size <= TRACE_MAX_RECORD_SIZE);
+		CHECK((location & 4095) + size <= 4096 ||
+			((location & 4095) == 0 && (size & 4095) == 0));
+		end = location + size;
+	}
+	return nu_trace_records;
+}
+
+static void CheckDispatch(Trace *trace, int nu_workers, int mode) {
+	trace->Dispatch(nu_workers, mode);
+	CHECK(trace->dispatch_start[0] == 0);
+	CHECK(trace->dispatch_start[nu_workers] == trace->nu_records);
+	uint8_t *seen = new uint8_t[trace->nu_records];
+	memset(seen, 0, trace->nu_records);
+	uint64_t trace_record_index = (uint64_t)- 1;
+	uint64_t *worker_of_trace_record = new uint64_t[trace->nu_records];
+	for (uint64_t i = 0; i < trace->nu_records; i++) {
+		if ((trace->size_flags[i] & TRACE_RECORD_CONTINUED) == 0)
+			trace_record_index++;
+		worker_of_trace_record[i] = trace_record_index;
+	}
+	for (int w = 0; w < nu_workers; w++)
+		for (uint64_t k = trace->dispatch_start[w]; k < trace->dispatch_start[w + 1]; k++) {
+			uint64_t i = trace->dispatch[k];
+			CHECK(i < trace->nu_records);
+			if (i >= trace->nu_records)
+				continue;
+			seen[i]++;
+			// The lists are in trace order.
+			if (k > trace->dispatch_start[w])
+				CHECK(trace->dispatch[k - 1] < i);
+			if (mode == TRACE_DISPATCH_ROUND_ROBIN)
+				CHECK(worker_of_trace_record[i] % nu_workers == (uint64_t)w);
+			else
+				CHECK((trace->stream != NULL ? trace->stream[i] : 0) % nu_workers == w);
+		}
+	for (uint64_t i = 0; i < trace->nu_records; i++)
+		CHECK(seen[i] == 1);
+	delete [] seen;
+	delete [] worker_of_trace_record;
+}
+
+static void CheckTraceFiles() {
+	uint8_t data[1024];
+	int n = 0;
+	// Aligned, unaligned and empty records.
+	n += EncodeFormat1(&data[n], false, 4096, 8192);
+	n += EncodeFormat2(&data[n], true, 0, 100);
+	n += EncodeFormat3(&data[n], false, 4000, 200);
+	n += EncodeFormat3(&data[n], true, 0x100000000ULL + 100, 3 * 4096);
+	n += EncodeFormat3(&data[n], false, 12288, 0);
+	// Records larger than TRACE_MAX_RECORD_SIZE, aligned and unaligned.
+	n += EncodeFormat3(&data[n], true, 1ULL << 40, 0x100000000ULL);
+	n += EncodeFormat3(&data[n], false, 0x7FFFFFFFFFFF0001ULL, 600 * 1024 * 1024 + 1);
+	// A truncated record at the end is ignored.
+	EncodeFormat4(&data[n], false, 0, 4096, 1, 0);
+	WriteTrace(data, n + 20);
+	Trace trace;
+	trace.Open(filename, false);
+	CHECK(trace.time == NULL);
+	CHECK(trace.stream == NULL);
+	CHECK(CheckPieces(&trace) == 7);
+	// 1 + 1 + 2 + 3 + 1 + 16 + 5 decoded records.
+	CHECK(trace.nu_records == 29);
+	if (trace.nu_records == 29) {
+		CHECK(trace.location[0] == 4096 && trace.size_flags[0] == 8192);
+		CHECK(trace.size_flags[1] == (100 | TRACE_RECORD_WRITE));
+		CHECK(trace.location[2] == 4000 && trace.size_flags[2] == 96);
+		CHECK(trace.location[3] == 4096 && trace.size_flags[3] ==
+			(104 | TRACE_RECORD_CONTINUED));
+		CHECK(trace.location[5] == 0x100001000ULL && trace.size_flags[5] ==
+			(8192 | TRACE_RECORD_WRITE | TRACE_RECORD_CONTINUED));
+		CHECK(trace.size_flags[6] == (100 | TRACE_RECORD_WRITE | TRACE_RECORD_CONTINUED));
+		CHECK(trace.location[7] == 12288 && trace.size_flags[7] == 0);
+		CHECK(trace.location[8] == 1ULL << 40 && trace.size_flags[8] ==
+			(TRACE_MAX_RECORD_SIZE | TRACE_RECORD_WRITE));
+		CHECK(trace.location[24] == 0x7FFFFFFFFFFF0001ULL);
+		CHECK(trace.size_flags[24] == 4095);
+		CHECK(trace.size_flags[26] == (TRACE_MAX_RECORD_SIZE | TRACE_RECORD_CONTINUED));
+		CHECK(trace.size_flags[27] == ((88 * 1024 * 1024 - 4096) | TRACE_RECORD_CONTINUED));
+		CHECK(trace.location[28] == 0x7FFFFFFFFFFF0001ULL + 600 * 1024 * 1024 - 1);
+		CHECK(trace.size_flags[28] == (2 | TRACE_RECORD_CONTINUED));
+	}
+	CheckDispatch(&trace, 1, TRACE_DISPATCH_STREAM);
+	CheckDispatch(&trace, 3, TRACE_DISPATCH_STREAM);
+	CheckDispatch(&trace, 3, TRACE_DISPATCH_ROUND_ROBIN);
+	trace.Close();
+	// Timestamped records in several streams, mixed with other formats.
+	n = 0;
+	n += EncodeFormat4(&data[n], false, 0, 4096, 3, 1000000);
+	n += EncodeFormat1(&data[n], true, 8192, 4096);
+	n += EncodeFormat4(&data[n], true, 100, 8192, 2, 999999);
+	n += EncodeFormat4(&data[n], false, 1ULL << 50, 512, 65535, 3000000);
+	WriteTrace(data, n);
+	trace.Open(filename, false);
+	CHECK(trace.time != NULL);
+	CHECK(trace.stream != NULL);
+	CHECK(CheckPieces(&trace) == 4);
+	CHECK(trace.nu_records == 6);
+	if (trace.nu_records == 6 && trace.time != NULL && trace.stream != NULL) {
+		CHECK(trace.size_flags[0] == (4096 | TRACE_RECORD_TIMED));
+		CHECK(trace.time[0] == 0 && trace.stream[0] == 3);
+		CHECK(trace.size_flags[1] == (4096 | TRACE_RECORD_WRITE));
+		CHECK(trace.stream[1] == 0);
+		// Times before the first timestamped record are clamped to 0.
+		CHECK(trace.time[2] == 0 && trace.time[4] == 0 && trace.stream[4] == 2);
+		CHECK(trace.size_flags[4] == (100 | TRACE_RECORD_WRITE | TRACE_RECORD_TIMED |
+			TRACE_RECORD_CONTINUED));
+		CHECK(trace.location[5] == 1ULL << 50 && trace.time[5] == 2000000);
+		CHECK(trace.stream[5] == 65535);
+	}
+	CheckDispatch(&trace, 4, TRACE_DISPATCH_STREAM);
+	CheckDispatch(&trace, 2, TRACE_DISPATCH_ROUND_ROBIN);
+	trace.Close();
+	// An empty trace.
+	WriteTrace(data, 0);
+	trace.Open(filename, false);
+	CHECK(trace.nu_records == 0);
+	CheckDispatch(&trace, 2, TRACE_DISPATCH_STREAM);
+	trace.Close();
+}
+
+int main(int argc, char **argv) {
+	CheckFormats();
+	const char *tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL || tmpdir[0] == '\0')
+		tmpdir = "/tmp";
+	char dirname[256];
+	snprintf(dirname, sizeof(dirname), "%s/trace-check-XXXXXX", tmpdir);
+	if (mkdtemp(dirname) == NULL)
+		FatalError("Could not create a temporary directory in %s.\n", tmpdir);
+	snprintf(filename, sizeof(filename), "%s/check.trace", dirname);
+	CheckTraceFiles();
+	unlink(filename);
+	rmdir(dirname);
+	if (nu_failures > 0) {
+		printf("%d of %d checks failed.\n", nu_failures, nu_checks);
+		return 1;
+	}
+	printf("All %d checks passed.\n", nu_checks);
+	return 0;
+}
@@ -0,0 +1,561 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flash-bench.h"
+#include "trace-file.h"
+
+static inline uint32_t ReadWord(const uint8_t *p) {
+	uint32_t word;
+	memcpy(&word, p, 4);
+	return word;
+}
+
+static inline uint64_t ReadDoubleWord(const uint8_t *p) {
+	uint64_t word;
+	memcpy(&word, p, 8);
+	return word;
+}
+
+int DecodeTraceRecord(const uint8_t *data, uint64_t remaining, TraceRecord *r) {
+	if (remaining < 8)
+		return 0;
+	uint32_t first_word = ReadWord(&data[0]);
+	uint32_t second_word = ReadWord(&data[4]);
+	r->time = 0;
+	r->stream = 0;
+	r->timed = false;
+	if ((first_word & 0x80000000) == 0) {
+		// Format 1: 8 bytes, 4K block units.
+		r->write = (first_word & 0x40000000) != 0;
+		r->size = (uint64_t)(first_word & 0x3FFFFFFF) * 4096;
+		r->location = (uint64_t)second_word * 4096;
+		return 8;
+	}
+	if ((first_word & 0x40000000) == 0) {
+		// Format 2: 8 bytes, location in blocks, size in bytes.
+		r->write = (first_word & 0x20000000) != 0;
+		r->location = (uint64_t)(first_word & 0x1FFFFFFF) * 4096;
+		r->size = second_word;
+		return 8;
+	}
+	// Formats 3 and 4: the size in bytes is split over the lower bits of the
+	// first word (most significant part) and the second word.
+	r->write = (first_word & 0x20000000) != 0;
+	if ((first_word & 0x10000000) == 0) {
+		// Format 3: 16 bytes, location and size in bytes.
+		if (remaining < 16)
+			return 0;
+		r->size = ((uint64_t)(first_word & 0x0FFFFFFF) << 32) | second_word;
+		r->location = ReadDoubleWord(&data[8]);
+		return 16;
+	}
+	// Format 4: 24 bytes, location and size in bytes, stream and time stamp.
+	if (remaining < 24)
+		return 0;
+	r->size = ((uint64_t)(first_word & 0xFFF) << 32) | second_word;
+	r->stream = (first_word >> 12) & 0xFFFF;
+	r->location = ReadDoubleWord(&data[8]);
+	r->time = ReadDoubleWord(&data[16]);
+	r->timed = true;
+	return 24;
+}
+
+// Layout of a decoded trace. The header and each of the arrays start on a
+// page boundary, so that parts of the arrays can be read ahead and released
+// independently.
+
+#define TRACE_CACHE_MAGIC "FBTRACE2"
+#define TRACE_CACHE_HAS_TIME 1
+#define TRACE_CACHE_HAS_STREAM 2
+
+class TraceCacheHeader {
+public :
+	char magic[8];
+	uint64_t trace_size;	// Size and modification time of the trace file.
+	int64_t trace_mtime_sec;
+	int64_t trace_mtime_nsec;
+	uint64_t nu_records;
+	uint32_t flags;
+};
+
+static inline uint64_t AlignToPage(uint64_t offset) {
+	return (offset + 4095) & ~(uint64_t)4095;
+}
+
+// Return the size of the mapping, and set the offsets of the arrays.
+
+static uint64_t GetLayout(uint64_t nu_records, uint32_t flags, uint64_t *size_flags_offset,
+uint64_t *time_offset, uint64_t *stream_offset) {
+	uint64_t offset = AlignToPage(sizeof(TraceCacheHeader));
+	offset = AlignToPage(offset + nu_records * sizeof(uint64_t));
+	*size_flags_offset = offset;
+	offset = AlignToPage(offset + nu_records * sizeof(uint32_t));
+	*time_offset = offset;
+	if (flags & TRACE_CACHE_HAS_TIME)
+		offset = AlignToPage(offset + nu_records * sizeof(uint64_t));
+	*stream_offset = offset;
+	if (flags & TRACE_CACHE_HAS_STREAM)
+		offset = AlignToPage(offset + nu_records * sizeof(uint16_t));
+	return offset;
+}
+
+static void SetArrays(Trace *trace, uint8_t *mapping, uint64_t nu_records, uint32_t flags) {
+	uint64_t size_flags_offset, time_offset, stream_offset;
+	GetLayout(nu_records, flags, &size_flags_offset, &time_offset, &stream_offset);
+	trace->nu_records = nu_records;
+	trace->location = (uint64_t *)(mapping + AlignToPage(sizeof(TraceCacheHeader)));
+	trace->size_flags = (uint32_t *)(mapping + size_flags_offset);
+	trace->time = NULL;
+	if (flags & TRACE_CACHE_HAS_TIME)
+		trace->time = (uint64_t *)(mapping + time_offset);
+	trace->stream = NULL;
+	if (flags & TRACE_CACHE_HAS_STREAM)
+		trace->stream = (uint16_t *)(mapping + stream_offset);
+}
+
+// Use an existing cache file if it is valid for the trace file.
+
+bool Trace::OpenCache(const char *cache_filename, const struct stat *trace_sb) {
+	int fd = open(cache_filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	TraceCacheHeader header;
+	struct stat sb;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &sb) != 0 ||
+	memcmp(header.magic, TRACE_CACHE_MAGIC, 8) != 0 ||
+	header.trace_size != (uint64_t)trace_sb->st_size ||
+	header.trace_mtime_sec != (int64_t)trace_sb->st_mtim.tv_sec ||
+	header.trace_mtime_nsec != (int64_t)trace_sb->st_mtim.tv_nsec) {
+		close(fd);
+		return false;
+	}
+	uint64_t size_flags_offset, time_offset, stream_offset;
+	mapping_size = GetLayout(header.nu_records, header.flags, &size_flags_offset,
+		&time_offset, &stream_offset);
+	if ((uint64_t)sb.st_size != mapping_size) {
+		close(fd);
+		return false;
+	}
+	mapping = (uint8_t *)mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	cache_fd = fd;
+	SetArrays(this, mapping, header.nu_records, header.flags);
+	return true;
+}
+
+// Return the size of the first decoded record of a trace record (see
+// trace-file.h).
+
+static inline uint64_t GetPieceSize(uint64_t location, uint64_t size) {
+	uint64_t offset = location & 4095;
+	if (offset != 0)
+		return size < 4096 - offset ? size : 4096 - offset;
+	if (size < 4096)
+		return size;
+	uint64_t blocks_size = size & ~(uint64_t)4095;
+	return blocks_size < TRACE_MAX_RECORD_SIZE ? blocks_size : TRACE_MAX_RECORD_SIZE;
+}
+
+// Return the number of decoded records of a trace record.
+
+static uint64_t GetNumberOfPieces(uint64_t location, uint64_t size) {
+	uint64_t n = 0;
+	do {
+		uint64_t piece_size = GetPieceSize(location, size);
+		location += piece_size;
+		size -= piece_size;
+		n++;
+	} while (size > 0);
+	return n;
+}
+
+// Create an unlinked temporary file in the directory of the given file, or
+// in the temporary directory if that is not possible. Returns - 1 on failure.
+
+static int CreateTemporaryFile(const char *filename) {
+	const char *tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL || tmpdir[0] == '\0')
+		tmpdir = "/tmp";
+	char *dir = new char[strlen(filename) + strlen(tmpdir) + 32];
+	strcpy(dir, filename);
+	char *slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+	int fd = - 1;
+	for (int i = 0; i < 2 && fd < 0; i++) {
+		if (i == 1)
+			strcpy(dir, tmpdir);
+		fd = open(dir, O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd >= 0)
+			break;
+		// The file system may not support O_TMPFILE.
+		char *name = dir + strlen(dir);
+		strcpy(name, "/.flash-bench-XXXXXX");
+		fd = mkstemp(dir);
+		if (fd >= 0)
+			unlink(dir);
+		*name = '\0';
+	}
+	delete [] dir;
+	return fd;
+}
+
+// Decode the trace file, into the cache file when cache_filename is not NULL,
+// and otherwise into an unlinked temporary file, so that the decoded trace can
+// be released from memory while it is replayed just like a cache file.
+
+void Trace::Decode(const char *filename, const char *cache_filename,
+const struct stat *trace_sb) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		FatalError("Could not open trace file %s.\n", filename);
+	uint64_t size = trace_sb->st_size;
+	uint8_t *data = NULL;
+	if (size > 0) {
+		data = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			FatalError("Could not map trace file %s.\n", filename);
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+	// Count the decoded records.
+	uint64_t nu_records = 0;
+	uint32_t flags = 0;
+	uint64_t bindex = 0;
+	while (bindex < size) {
+		TraceRecord r;
+		int record_size = DecodeTraceRecord(&data[bindex], size - bindex, &r);
+		if (record_size == 0) {
+			Message("Warning: truncated record at end of trace file %s.\n", filename);
+			size = bindex;
+			break;
+		}
+		bindex += record_size;
+		nu_records += GetNumberOfPieces(r.location, r.size);
+		if (r.timed)
+			flags |= TRACE_CACHE_HAS_TIME;
+		if (r.stream != 0)
+			flags |= TRACE_CACHE_HAS_STREAM;
+	}
+	uint64_t size_flags_offset, time_offset, stream_offset;
+	mapping_size = GetLayout(nu_records, flags, &size_flags_offset, &time_offset,
+		&stream_offset);
+	cache_fd = - 1;
+	bool temporary = true;
+	if (cache_filename != NULL) {
+		cache_fd = open(cache_filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR |
+			S_IRGRP | S_IROTH);
+		if (cache_fd >= 0 && ftruncate(cache_fd, mapping_size) != 0) {
+			close(cache_fd);
+			unlink(cache_filename);
+			cache_fd = - 1;
+		}
+		if (cache_fd < 0)
+			Message("Warning: could not create trace cache file %s.\n", cache_filename);
+		else
+			temporary = false;
+	}
+	if (cache_fd < 0) {
+		cache_fd = CreateTemporaryFile(filename);
+		if (cache_fd >= 0 && ftruncate(cache_fd, mapping_size) != 0) {
+			close(cache_fd);
+			cache_fd = - 1;
+		}
+	}
+	if (cache_fd >= 0)
+		mapping = (uint8_t *)mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			cache_fd, 0);
+	else {
+		Message("Warning: could not create a temporary file for trace file %s, "
+			"keeping it in memory.\n", filename);
+		mapping = (uint8_t *)mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, - 1, 0);
+	}
+	if (mapping == MAP_FAILED)
+		FatalError("Could not allocate memory for trace file %s.\n", filename);
+	SetArrays(this, mapping, nu_records, flags);
+	// Decode the records.
+	bool first_timed_record = true;
+	uint64_t first_record_time = 0;
+	uint64_t i = 0;
+	bindex = 0;
+	while (bindex < size) {
+		TraceRecord r;
+		bindex += DecodeTraceRecord(&data[bindex], size - bindex, &r);
+		uint32_t record_flags = 0;
+		if (r.write)
+			record_flags |= TRACE_RECORD_WRITE;
+		uint64_t record_time = 0;
+		if (r.timed) {
+			if (first_timed_record) {
+				first_record_time = r.time;
+				first_timed_record = false;
+			}
+			record_flags |= TRACE_RECORD_TIMED;
+			if (r.time > first_record_time)
+				record_time = r.time - first_record_time;
+		}
+		do {
+			uint64_t piece_size = GetPieceSize(r.location, r.size);
+			location[i] = r.location;
+			size_flags[i] = piece_size | record_flags;
+			if (time != NULL)
+				time[i] = record_time;
+			if (stream != NULL)
+				stream[i] = r.stream;
+			i++;
+			r.location += piece_size;
+			r.size -= piece_size;
+			record_flags |= TRACE_RECORD_CONTINUED;
+		} while (r.size > 0);
+	}
+	if (size > 0)
+		munmap(data, trace_sb->st_size);
+	// The trace file itself is no longer needed.
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	if (cache_fd < 0)
+		return;
+	if (!temporary) {
+		// Write the header last, so that an incomplete cache file is not used.
+		TraceCacheHeader *header = (TraceCacheHeader *)mapping;
+		header->trace_size = trace_sb->st_size;
+		header->trace_mtime_sec = trace_sb->st_mtim.tv_sec;
+		header->trace_mtime_nsec = trace_sb->st_mtim.tv_nsec;
+		header->nu_records = nu_records;
+		header->flags = flags;
+		memcpy(header->magic, TRACE_CACHE_MAGIC, 8);
+	}
+	// Write the decoded trace back now rather than during the benchmark.
+	msync(mapping, mapping_size, MS_SYNC);
+	AdviseRecords(0, nu_records, true);
+}
+
+// Create the (memory-mapped) file for the dispatch lists.
+
+void Trace::CreateDispatch(const char *filename) {
+	dispatch_workers = 0;
+	dispatch_start = NULL;
+	dispatch_size = AlignToPage(nu_records * sizeof(uint64_t));
+	if (dispatch_size == 0)
+		dispatch_size = 4096;
+	dispatch_fd = CreateTemporaryFile(filename);
+	if (dispatch_fd >= 0 && ftruncate(dispatch_fd, dispatch_size) != 0) {
+		close(dispatch_fd);
+		dispatch_fd = - 1;
+	}
+	if (dispatch_fd >= 0)
+		dispatch = (uint64_t *)mmap(NULL, dispatch_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, dispatch_fd, 0);
+	else
+		dispatch = (uint64_t *)mmap(NULL, dispatch_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, - 1, 0);
+	if (dispatch == MAP_FAILED)
+		FatalError("Could not allocate memory for trace file %s.\n", filename);
+}
+
+void Trace::Open(const char *filename, bool use_cache) {
+	struct stat sb;
+	if (stat(filename, &sb) != 0)
+		FatalError("Could not open trace file %s.\n", filename);
+	released_records = 0;
+	char *cache_filename = NULL;
+	if (use_cache) {
+		cache_filename = new char[strlen(filename) + 9];
+		sprintf(cache_filename, "%s.decoded", filename);
+		if (OpenCache(cache_filename, &sb)) {
+			Message("Using decoded trace file %s (%llu records).\n", cache_filename,
+				(unsigned long long)nu_records);
+			delete [] cache_filename;
+			CreateDispatch(filename);
+			return;
+		}
+	}
+	Message("Decoding trace file %s (%dMB)", filename, (int)((sb.st_size + 524288) >> 20));
+	Decode(filename, cache_filename, &sb);
+	Message(", %llu records.\n", (unsigned long long)nu_records);
+	delete [] cache_filename;
+	CreateDispatch(filename);
+}
+
+void Trace::Close() {
+	munmap(mapping, mapping_size);
+	if (cache_fd >= 0)
+		close(cache_fd);
+	munmap(dispatch, dispatch_size);
+	if (dispatch_fd >= 0)
+		close(dispatch_fd);
+	delete [] dispatch_start;
+}
+
+// Return the worker that replays a record. The index of the trace record it
+// belongs to is tracked for round-robin dispatch, which keeps the decoded
+// records of a trace record together; it must be initialized to - 1 and the
+// records must be visited in order.
+
+int Trace::GetDispatchWorker(uint64_t record_index, uint64_t *trace_record_index) {
+	if (dispatch_mode == TRACE_DISPATCH_ROUND_ROBIN) {
+		if ((size_flags[record_index] & TRACE_RECORD_CONTINUED) == 0)
+			(*trace_record_index)++;
+		return *trace_record_index % dispatch_workers;
+	}
+	if (stream == NULL)
+		return 0;
+	return stream[record_index] % dispatch_workers;
+}
+
+void Trace::Dispatch(int nu_workers, int mode) {
+	if (nu_workers == dispatch_workers && mode == dispatch_mode)
+		return;
+	dispatch_workers = nu_workers;
+	dispatch_mode = mode;
+	delete [] dispatch_start;
+	dispatch_start = new uint64_t[nu_workers + 1];
+	// Count the records of each worker, then fill in the lists.
+	uint64_t *position = new uint64_t[nu_workers];
+	memset(position, 0, sizeof(uint64_t) * nu_workers);
+	uint64_t trace_record_index = (uint64_t)- 1;
+	for (uint64_t i = 0; i < nu_records; i++)
+		position[GetDispatchWorker(i, &trace_record_index)]++;
+	uint64_t start = 0;
+	for (int i = 0; i < nu_workers; i++) {
+		dispatch_start[i] = start;
+		start += position[i];
+		position[i] = dispatch_start[i];
+	}
+	dispatch_start[nu_workers] = start;
+	trace_record_index = (uint64_t)- 1;
+	for (uint64_t i = 0; i < nu_records; i++)
+		dispatch[position[GetDispatchWorker(i, &trace_record_index)]++] = i;
+	delete [] position;
+	// Write the lists back now rather than during the benchmark, and release
+	// them and the records.
+	if (dispatch_fd >= 0) {
+		msync(dispatch, dispatch_size, MS_SYNC);
+		madvise(dispatch, dispatch_size, MADV_DONTNEED);
+		posix_fadvise(dispatch_fd, 0, dispatch_size, POSIX_FADV_DONTNEED);
+	}
+	AdviseRecords(0, nu_records, true);
+}
+
+// Advise about the byte range from start to stop of a memory-mapped file. A
+// partially used page at either end is still needed when releasing, unless
+// final is set (the file is padded to a page boundary).
+
+static void AdviseRange(uint8_t *mapping, int fd, uint64_t start, uint64_t stop,
+bool release, bool final) {
+	start &= ~(uint64_t)4095;
+	if (release && !final)
+		stop &= ~(uint64_t)4095;
+	else
+		stop = AlignToPage(stop);
+	if (stop <= start)
+		return;
+	if (release) {
+		// Drop the pages from the mapping first, since mapped pages cannot
+		// be evicted from the page cache. The mapping itself remains valid.
+		madvise(mapping + start, stop - start, MADV_DONTNEED);
+		posix_fadvise(fd, start, stop - start, POSIX_FADV_DONTNEED);
+	}
+	else
+		madvise(mapping + start, stop - start, MADV_WILLNEED);
+}
+
+// Advise about the records from first up to end in all arrays. Does not apply
+// when the arrays are in anonymous memory, which cannot be released without
+// losing it.
+
+void Trace::AdviseRecords(uint64_t first, uint64_t end, bool release) {
+	if (cache_fd < 0)
+		return;
+	uint8_t *arrays[4] = { (uint8_t *)location, (uint8_t *)size_flags, (uint8_t *)time,
+		(uint8_t *)stream };
+	int element_size[4] = { 8, 4, 8, 2 };
+	for (int i = 0; i < 4; i++) {
+		if (arrays[i] == NULL)
+			continue;
+		AdviseRange(mapping, cache_fd, arrays[i] - mapping + first * element_size[i],
+			arrays[i] - mapping + end * element_size[i], release, end >= nu_records);
+	}
+}
+
+void Trace::ReadAhead(uint64_t record_index) {
+	uint64_t first = record_index / TRACE_CHUNK_RECORDS * TRACE_CHUNK_RECORDS;
+	if (first >= nu_records)
+		return;
+	uint64_t end = first + (uint64_t)TRACE_CHUNK_RECORDS * TRACE_READ_AHEAD_CHUNKS;
+	if (end > nu_records)
+		end = nu_records;
+	AdviseRecords(first, end, false);
+}
+
+void Trace::Release(uint64_t record_index) {
+	uint64_t end = record_index / TRACE_CHUNK_RECORDS * TRACE_CHUNK_RECORDS;
+	if (record_index >= nu_records)
+		end = nu_records;
+	uint64_t first = __atomic_load_n(&released_records, __ATOMIC_RELAXED);
+	for (;;) {
+		if (end <= first)
+			return;
+		if (__atomic_compare_exchange_n(&released_records, &first, end, false,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+	AdviseRecords(first, end, true);
+}
+
+void Trace::AdviseDispatch(int worker, uint64_t dispatch_index) {
+	if (dispatch_fd < 0)
+		return;
+	uint64_t first = dispatch_start[worker];
+	uint64_t end = dispatch_start[worker + 1];
+	uint64_t chunk = first + (dispatch_index - first) / TRACE_CHUNK_RECORDS *
+		TRACE_CHUNK_RECORDS;
+	if (dispatch_index >= end)
+		chunk = end;
+	if (chunk > first) {
+		uint64_t previous_chunk = first + (chunk - 1 - first) / TRACE_CHUNK_RECORDS *
+			TRACE_CHUNK_RECORDS;
+		AdviseRange((uint8_t *)dispatch, dispatch_fd, previous_chunk * sizeof(uint64_t),
+			chunk * sizeof(uint64_t), true, chunk == nu_records);
+	}
+	if (chunk < end) {
+		uint64_t read_ahead_end = chunk + (uint64_t)TRACE_CHUNK_RECORDS *
+			TRACE_READ_AHEAD_CHUNKS;
+		if (read_ahead_end > end)
+			read_ahead_end = end;
+		AdviseRange((uint8_t *)dispatch, dispatch_fd, chunk * sizeof(uint64_t),
+			read_ahead_end * sizeof(uint64_t), false, false);
+	}
+}
@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Trace files. A trace is a sequence of disk transactions in one of several
+// record formats (described in the README), which may be mixed within a file.
+// Requires stdint.h and sys/stat.h to be included first.
+
+// The number of streams that timestamped records can identify.
+
+#define TRACE_MAX_STREAMS 65536
+
+// A record of a trace file, as decoded by DecodeTraceRecord(). The time stamp
+// and stream are only defined for timestamped records (format 4); other
+// records belong to stream 0.
+
+class TraceRecord {
+public :
+	uint64_t location;	// In bytes.
+	uint64_t size;		// In bytes.
+	uint64_t time;		// Nanoseconds, relative to an arbitrary origin.
+	int stream;
+	bool write;
+	bool timed;
+};
+
+// Decode the trace record at data, of which at most remaining bytes may be
+// read. Returns the size of the record in bytes, or 0 if the record is
+// truncated.
+
+int DecodeTraceRecord(const uint8_t *data, uint64_t remaining, TraceRecord *r);
+
+// Flags stored in the upper bits of the size of a decoded record. Trace
+// records are split into decoded records that either lie within a single 4K
+// block, or start at a block boundary and consist of whole blocks (at most
+// TRACE_MAX_RECORD_SIZE bytes), so that they can be replayed as 4K
+// transactions without further splitting. All decoded records of a trace
+// record except the first one are flagged as continued.
+
+#define TRACE_RECORD_WRITE 0x80000000
+#define TRACE_RECORD_TIMED 0x40000000
+#define TRACE_RECORD_CONTINUED 0x20000000
+#define TRACE_RECORD_SIZE_MASK 0x1FFFFFFF
+#define TRACE_MAX_RECORD_SIZE 0x10000000
+
+// While a trace is replayed, it is read ahead and released in chunks of this
+// number of records.
+
+#define TRACE_CHUNK_RECORDS (512 * 1024)
+#define TRACE_READ_AHEAD_CHUNKS 4
+
+// How the records of a trace are divided among the worker threads.
+
+enum { TRACE_DISPATCH_STREAM = 0, TRACE_DISPATCH_ROUND_ROBIN = 1 };
+
+// A trace, decoded once when it is opened into separate arrays of record
+// fields, so that replaying it requires no decoding. The arrays are stored in
+// a memory-mapped file: an unlinked temporary file, or, when a cache is used,
+// a file next to the trace file (with the extension .decoded) that is reused
+// as long as the trace file does not change. The trace is read ahead while it
+// is replayed, and the part that has been replayed is released from the page
+// cache, so that memory use is bounded and the trace has little effect on
+// the caching of the device under test.
+//
+// Before a replay, the indices of the records are sorted into a list per
+// worker (stored in another temporary file), so that every worker only visits
+// its own records.
+
+class Trace {
+private :
+	uint8_t *mapping;
+	uint64_t mapping_size;
+	int cache_fd;		// - 1 when no file could be created and the arrays
+				// are in anonymous memory.
+	uint64_t released_records;
+	uint64_t dispatch_size;
+	int dispatch_fd;	// Idem for the dispatch lists.
+	int dispatch_workers;
+	int dispatch_mode;
+
+	bool OpenCache(const char *cache_filename, const struct stat *trace_sb);
+	void Decode(const char *filename, const char *cache_filename,
+		const struct stat *trace_sb);
+	void CreateDispatch(const char *filename);
+	int GetDispatchWorker(uint64_t record_index, uint64_t *trace_record_index);
+	void AdviseRecords(uint64_t first, uint64_t end, bool release);
+public :
+	uint64_t nu_records;
+	uint64_t *location;
+	uint32_t *size_flags;	// Size in bytes, combined with the flags above.
+	// Time stamps in nanoseconds relative to the first timestamped record (NULL
+	// if there are none), and streams (NULL if all records are in stream 0).
+	uint64_t *time;
+	uint16_t *stream;
+	// The record indices of all dispatch lists, and the start of the list of
+	// each worker followed by the end of the last one.
+	uint64_t *dispatch;
+	uint64_t *dispatch_start;
+
+	// Open and decode a trace file, exiting with an error if that fails.
+	void Open(const char *filename, bool use_cache);
+	void Close();
+	// Divide the records among the given number of workers, unless they
+	// already are.
+	void Dispatch(int nu_workers, int mode);
+	// Prepare for a new replay.
+	void Rewind() {
+		released_records = 0;
+	}
+	// Advise that the chunk containing the given record and the chunks
+	// following it will be needed soon.
+	void ReadAhead(uint64_t record_index);
+	// Release the whole chunks before the given record (which is the lowest
+	// replay position of all workers). Can be called by multiple threads at a
+	// time.
+	void Release(uint64_t record_index);
+	// Read ahead the dispatch list of a worker from the given position, and
+	// release the chunk before it.
+	void AdviseDispatch(int worker, uint64_t dispatch_index);
+};
+
+// Statistics of a single stream of a trace replay. The end time is the time
+// stamp at which the stream's last transaction was performed (queued, for
+// asynchronous engines).
+
+class TraceStreamStatistics {
+public :
+	uint64_t nu_reads;
+	uint64_t nu_writes;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	uint64_t end_time;
+};
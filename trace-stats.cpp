@@ -0,0 +1,424 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flash-bench.h"
+#include "trace-file.h"
+#include "trace-stats.h"
+
+// Working set and reuse distances are computed in units of 4K blocks.
+#define BLOCK_SHIFT 12
+// The maximum number of distinct blocks that are tracked. When a trace touches
+// more blocks, only a sample of the blocks is tracked.
+#define MAX_SAMPLED_BLOCKS (1 << 19)
+#define TABLE_SIZE (1 << 21)
+#define TABLE_MASK (TABLE_SIZE - 1)
+// The number of distinct access times before the times are renumbered.
+#define TREE_SIZE (1 << 21)
+#define SAMPLE_RANGE (1 << 24)
+// Size buckets from 512 bytes to 1GB; larger records fall in the last bucket.
+#define NU_SIZE_BUCKETS 22
+// Reuse distance buckets; bucket i > 0 holds distances from 2 ^ (i - 1) to
+// 2 ^ i - 1 blocks, bucket 0 a distance of zero (the block itself).
+#define NU_REUSE_BUCKETS 40
+#define NU_HEAT_BUCKETS 32
+// The part of the trace file after which the processed part is released from
+// the page cache.
+#define RELEASE_SIZE (64 * 1024 * 1024)
+
+static inline uint64_t HashBlock(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+class SampledBlock {
+public :
+	uint64_t block;
+	uint32_t time;		// Time of the last access; 0 for an empty slot.
+	uint32_t written;
+};
+
+// Reuse distance analysis with spatially hashed sampling (as in SHARDS). A
+// block is sampled when its hash is below a threshold; the sampled blocks are
+// kept in a hash table together with the time of their last access. The
+// number of distinct sampled blocks accessed since the last access of a block
+// is the number of sampled blocks with a later last access time, which is
+// counted with a Fenwick tree over the access times. Distances and counts are
+// scaled by the inverse of the sampling rate. When too many blocks are
+// sampled, the threshold is halved and the blocks above it are removed.
+
+class ReuseDistanceAnalyzer {
+private :
+	SampledBlock *table;
+	uint32_t *tree;
+	uint32_t time;
+	uint32_t nu_marks;
+	uint64_t nu_sampled_blocks;
+	uint64_t threshold;
+
+	void Mark(uint32_t t, int delta) {
+		for (; t < TREE_SIZE; t += t & (- t))
+			tree[t] += delta;
+		nu_marks += delta;
+	}
+	uint32_t CountUpTo(uint32_t t) const {
+		uint32_t count = 0;
+		for (; t > 0; t -= t & (- t))
+			count += tree[t];
+		return count;
+	}
+	SampledBlock *Lookup(uint64_t block, uint64_t hash) {
+		for (uint64_t i = hash & TABLE_MASK;; i = (i + 1) & TABLE_MASK)
+			if (table[i].time == 0 || table[i].block == block)
+				return &table[i];
+	}
+	void Rebuild();
+	static int CompareTime(const void *a, const void *b);
+public :
+	double first_accesses;
+	double reuse[NU_REUSE_BUCKETS];
+
+	ReuseDistanceAnalyzer();
+	~ReuseDistanceAnalyzer();
+	void Access(uint64_t block, bool write);
+	double GetSamplingRate() const {
+		return (double)threshold / SAMPLE_RANGE;
+	}
+	// Estimated number of distinct blocks and of blocks that were written.
+	double GetWorkingSet() const {
+		return nu_sampled_blocks / GetSamplingRate();
+	}
+	double GetWrittenSet() const;
+};
+
+ReuseDistanceAnalyzer::ReuseDistanceAnalyzer() {
+	table = new SampledBlock[TABLE_SIZE];
+	tree = new uint32_t[TREE_SIZE];
+	memset(table, 0, sizeof(SampledBlock) * TABLE_SIZE);
+	memset(tree, 0, sizeof(uint32_t) * TREE_SIZE);
+	time = 0;
+	nu_marks = 0;
+	nu_sampled_blocks = 0;
+	threshold = SAMPLE_RANGE;
+	first_accesses = 0;
+	for (int i = 0; i < NU_REUSE_BUCKETS; i++)
+		reuse[i] = 0;
+}
+
+ReuseDistanceAnalyzer::~ReuseDistanceAnalyzer() {
+	delete [] table;
+	delete [] tree;
+}
+
+int ReuseDistanceAnalyzer::CompareTime(const void *a, const void *b) {
+	uint32_t time_a = ((const SampledBlock *)a)->time;
+	uint32_t time_b = ((const SampledBlock *)b)->time;
+	return time_a < time_b ? - 1 : (time_a > time_b ? 1 : 0);
+}
+
+// Remove the blocks that are no longer sampled and renumber the access times
+// from 1, preserving their order.
+
+void ReuseDistanceAnalyzer::Rebuild() {
+	SampledBlock *blocks = new SampledBlock[nu_sampled_blocks];
+	uint64_t n = 0;
+	for (uint64_t i = 0; i < TABLE_SIZE; i++)
+		if (table[i].time != 0 && (HashBlock(table[i].block) >> 40) < threshold)
+			blocks[n++] = table[i];
+	qsort(blocks, n, sizeof(SampledBlock), CompareTime);
+	memset(table, 0, sizeof(SampledBlock) * TABLE_SIZE);
+	memset(tree, 0, sizeof(uint32_t) * TREE_SIZE);
+	nu_marks = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		SampledBlock *b = Lookup(blocks[i].block, HashBlock(blocks[i].block));
+		*b = blocks[i];
+		b->time = i + 1;
+		Mark(i + 1, 1);
+	}
+	time = n;
+	nu_sampled_blocks = n;
+	delete [] blocks;
+}
+
+void ReuseDistanceAnalyzer::Access(uint64_t block, bool write) {
+	uint64_t hash = HashBlock(block);
+	if ((hash >> 40) >= threshold)
+		return;
+	if (time + 1 >= TREE_SIZE)
+		Rebuild();
+	double rate = GetSamplingRate();
+	SampledBlock *b = Lookup(block, hash);
+	if (b->time == 0) {
+		b->block = block;
+		b->written = 0;
+		first_accesses += 1.0 / rate;
+		nu_sampled_blocks++;
+	}
+	else {
+		// The number of distinct sampled blocks accessed since the last access.
+		uint64_t distance = (uint64_t)((nu_marks - CountUpTo(b->time)) / rate);
+		int bucket = 0;
+		while (distance > 0 && bucket < NU_REUSE_BUCKETS - 1) {
+			distance >>= 1;
+			bucket++;
+		}
+		reuse[bucket] += 1.0 / rate;
+		Mark(b->time, - 1);
+	}
+	time++;
+	b->time = time;
+	b->written |= write;
+	Mark(time, 1);
+	if (nu_sampled_blocks > MAX_SAMPLED_BLOCKS) {
+		threshold /= 2;
+		Rebuild();
+	}
+}
+
+double ReuseDistanceAnalyzer::GetWrittenSet() const {
+	uint64_t count = 0;
+	for (uint64_t i = 0; i < TABLE_SIZE; i++)
+		if (table[i].time != 0 && table[i].written)
+			count++;
+	return count / GetSamplingRate();
+}
+
+// Format a size in bytes with a unit, rounding to one decimal when needed.
+
+static const char *FormatBytes(double size, char *s) {
+	const char *unit[5] = { "B", "K", "M", "G", "T" };
+	int i = 0;
+	while (size >= 1024 && i < 4) {
+		size /= 1024;
+		i++;
+	}
+	if (size == (int64_t)size)
+		sprintf(s, "%d%s", (int)size, unit[i]);
+	else
+		sprintf(s, "%.1lf%s", size, unit[i]);
+	return s;
+}
+
+static double Percentage(double count, double total) {
+	return total > 0 ? count * 100.0 / total : 0;
+}
+
+void AnalyzeTrace(const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0)
+		FatalError("Could not open trace file %s.\n", filename);
+	uint64_t size = sb.st_size;
+	uint8_t *data = NULL;
+	if (size > 0) {
+		data = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			FatalError("Could not map trace file %s.\n", filename);
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+	uint64_t nu_records = 0;
+	uint64_t nu_reads = 0;
+	uint64_t nu_writes = 0;
+	uint64_t read_bytes = 0;
+	uint64_t write_bytes = 0;
+	uint64_t nu_sequential = 0;
+	uint64_t nu_followed = 0;	// Records that follow a record of the same stream.
+	uint64_t nu_timed = 0;
+	uint64_t first_time = 0;
+	uint64_t last_time = 0;
+	uint64_t max_end = 0;
+	uint64_t size_count[NU_SIZE_BUCKETS];
+	memset(size_count, 0, sizeof(size_count));
+	uint64_t *stream_end = new uint64_t[TRACE_MAX_STREAMS];
+	bool *stream_seen = new bool[TRACE_MAX_STREAMS];
+	memset(stream_seen, 0, TRACE_MAX_STREAMS);
+	int nu_streams = 0;
+	// The heat map buckets double in size when the address range grows.
+	uint64_t heat_bucket_size = 1024 * 1024;
+	uint64_t heat_read[NU_HEAT_BUCKETS];
+	uint64_t heat_write[NU_HEAT_BUCKETS];
+	memset(heat_read, 0, sizeof(heat_read));
+	memset(heat_write, 0, sizeof(heat_write));
+	ReuseDistanceAnalyzer *rd = new ReuseDistanceAnalyzer;
+	uint64_t released_size = 0;
+	uint64_t bindex = 0;
+	bool truncated = false;
+	while (bindex < size) {
+		TraceRecord r;
+		int record_size = DecodeTraceRecord(&data[bindex], size - bindex, &r);
+		if (record_size == 0) {
+			truncated = true;
+			break;
+		}
+		bindex += record_size;
+		nu_records++;
+		if (r.write) {
+			nu_writes++;
+			write_bytes += r.size;
+		}
+		else {
+			nu_reads++;
+			read_bytes += r.size;
+		}
+		int bucket = 0;
+		while (bucket < NU_SIZE_BUCKETS - 1 && r.size > ((uint64_t)512 << bucket))
+			bucket++;
+		size_count[bucket]++;
+		if (r.timed) {
+			if (nu_timed == 0)
+				first_time = r.time;
+			last_time = r.time;
+			nu_timed++;
+		}
+		if (stream_seen[r.stream]) {
+			nu_followed++;
+			if (r.location == stream_end[r.stream])
+				nu_sequential++;
+		}
+		else {
+			stream_seen[r.stream] = true;
+			nu_streams++;
+		}
+		stream_end[r.stream] = r.location + r.size;
+		// The end of a record near the top of the 64-bit range can overflow.
+		uint64_t end = r.location + r.size;
+		if (end < r.location)
+			end = UINT64_MAX;
+		if (end > max_end)
+			max_end = end;
+		// Written so that it cannot overflow for large locations.
+		while (r.location / NU_HEAT_BUCKETS >= heat_bucket_size) {
+			for (int i = 0; i < NU_HEAT_BUCKETS / 2; i++) {
+				heat_read[i] = heat_read[i * 2] + heat_read[i * 2 + 1];
+				heat_write[i] = heat_write[i * 2] + heat_write[i * 2 + 1];
+			}
+			for (int i = NU_HEAT_BUCKETS / 2; i < NU_HEAT_BUCKETS; i++) {
+				heat_read[i] = 0;
+				heat_write[i] = 0;
+			}
+			heat_bucket_size *= 2;
+		}
+		if (r.write)
+			heat_write[r.location / heat_bucket_size] += r.size;
+		else
+			heat_read[r.location / heat_bucket_size] += r.size;
+		if (r.size > 0) {
+			uint64_t last_block = (r.location + r.size - 1) >> BLOCK_SHIFT;
+			for (uint64_t b = r.location >> BLOCK_SHIFT; b <= last_block; b++)
+				rd->Access(b, r.write);
+		}
+		// Release the part of the trace that has been processed.
+		if (bindex - released_size >= RELEASE_SIZE) {
+			uint64_t end = bindex & ~(uint64_t)(RELEASE_SIZE - 1);
+			madvise(data + released_size, end - released_size, MADV_DONTNEED);
+			posix_fadvise(fd, released_size, end - released_size, POSIX_FADV_DONTNEED);
+			released_size = end;
+		}
+	}
+	if (size > 0)
+		munmap(data, size);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	char s1[16], s2[16];
+	Message("Trace file %s: %s, %llu records", filename, FormatBytes(size, s1),
+		(unsigned long long)nu_records);
+	if (truncated)
+		Message(" (the last record is truncated)");
+	Message("\n");
+	Message("Reads: %llu (%.1lf%%), %s; writes: %llu (%.1lf%%), %s\n",
+		(unsigned long long)nu_reads, Percentage(nu_reads, nu_records),
+		FormatBytes(read_bytes, s1), (unsigned long long)nu_writes,
+		Percentage(nu_writes, nu_records), FormatBytes(write_bytes, s2));
+	Message("Address range: 0 - %s\n", FormatBytes(max_end, s1));
+	Message("Streams: %d, sequential records: %.1lf%% (starting where the previous record "
+		"of the same stream ended)\n", nu_streams, Percentage(nu_sequential, nu_followed));
+	if (nu_timed > 0)
+		Message("Timestamped records: %llu, time span %.3lfs\n", (unsigned long long)nu_timed,
+			(double)(last_time - first_time) * 0.000000001);
+
+	Message("Record sizes:\n");
+	for (int i = 0; i < NU_SIZE_BUCKETS; i++) {
+		if (size_count[i] == 0)
+			continue;
+		Message("    %s%-6s %12llu  %5.1lf%%\n", i == NU_SIZE_BUCKETS - 1 ? "> " : "<= ",
+			FormatBytes(i == NU_SIZE_BUCKETS - 1 ? (512 << (i - 1)) : (512 << i), s1),
+			(unsigned long long)size_count[i], Percentage(size_count[i], nu_records));
+	}
+
+	double rate = rd->GetSamplingRate();
+	Message("Working set: %s (4K blocks accessed), written: %s", FormatBytes(
+		rd->GetWorkingSet() * 4096, s1), FormatBytes(rd->GetWrittenSet() * 4096, s2));
+	if (rate < 1.0)
+		Message(" (estimated from a 1/%d sample of the blocks)", (int)(1.0 / rate + 0.5));
+	Message("\n");
+
+	// Reuse distances, expressed as the size of an LRU cache that holds the
+	// block at its next access.
+	double total_accesses = rd->first_accesses;
+	int last_bucket = 0;
+	for (int i = 0; i < NU_REUSE_BUCKETS; i++) {
+		total_accesses += rd->reuse[i];
+		if (rd->reuse[i] > 0)
+			last_bucket = i;
+	}
+	Message("Reuse distance (4K block accesses, by LRU cache size needed for a hit):\n");
+	Message("    First access     %5.1lf%%\n", Percentage(rd->first_accesses,
+		total_accesses));
+	double cumulative = 0;
+	for (int i = 0; i <= last_bucket; i++) {
+		cumulative += rd->reuse[i];
+		// Distances below 1MB are combined.
+		if (i < 8 && i < last_bucket)
+			continue;
+		Message("    <= %-12s %5.1lf%%   (hit ratio %5.1lf%%)\n",
+			FormatBytes((double)((uint64_t)1 << i) * 4096, s1),
+			Percentage(i < 8 ? cumulative : rd->reuse[i], total_accesses),
+			Percentage(cumulative, total_accesses));
+	}
+
+	Message("Accesses by location (bytes transferred, by start of record):\n");
+	uint64_t max_heat = 0;
+	for (int i = 0; i < NU_HEAT_BUCKETS; i++)
+		if (heat_read[i] + heat_write[i] > max_heat)
+			max_heat = heat_read[i] + heat_write[i];
+	uint64_t total_bytes = read_bytes + write_bytes;
+	for (int i = 0; i < NU_HEAT_BUCKETS && (uint64_t)i * heat_bucket_size < max_end; i++) {
+		Message("    %8s - %-8s read %5.1lf%%, write %5.1lf%% ",
+			FormatBytes((double)i * heat_bucket_size, s1),
+			FormatBytes((double)(i + 1) * heat_bucket_size, s2),
+			Percentage(heat_read[i], total_bytes), Percentage(heat_write[i], total_bytes));
+		int length = max_heat > 0 ? (heat_read[i] + heat_write[i]) * 40 / max_heat : 0;
+		for (int j = 0; j < length; j++)
+			Message("#");
+		Message("\n");
+	}
+	delete rd;
+	delete [] stream_end;
+	delete [] stream_seen;
+}
@@ -0,0 +1,28 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Trace analysis (--trace-stats). Requires stdint.h to be included first.
+
+// Scan a trace file and report its read/write mix, transaction sizes,
+// sequentiality, working set size, reuse distances and the distribution of
+// the accesses over the address range. The file is read sequentially in a
+// single pass, and memory use is bounded regardless of the size of the trace:
+// the working set and reuse distances are computed exactly for small traces
+// and estimated from a spatially hashed sample of the blocks for larger ones.
+
+void AnalyzeTrace(const char *filename);
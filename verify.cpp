@@ -0,0 +1,261 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "latency-histogram.h"
+#include "buffer-pool.h"
+#include "io-engine.h"
+#include "verify.h"
+
+#define CRC32C_POLYNOMIAL 0x82F63B78	// Reversed Castagnoli polynomial.
+
+// Tables for the software implementation, which processes 8 bytes at a time
+// ("slicing-by-8").
+static uint32_t crc32c_table[8][256];
+
+static const char *verify_result_description[NU_VERIFY_RESULTS] = {
+	"OK", "no header (block not written)", "wrong offset (misdirected write)",
+	"bad checksum (corrupted data)", "stale data (earlier write)"
+};
+
+static void InitializeTables() {
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+		crc32c_table[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++)
+		for (int k = 1; k < 8; k++)
+			crc32c_table[k][i] = (crc32c_table[k - 1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[k - 1][i] & 0xFF];
+}
+
+static uint32_t CRC32CSoftware(uint32_t crc, const uint8_t *p, size_t size) {
+	for (; size >= 8; size -= 8, p += 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		word ^= crc;
+		crc = crc32c_table[7][word & 0xFF] ^
+			crc32c_table[6][(word >> 8) & 0xFF] ^
+			crc32c_table[5][(word >> 16) & 0xFF] ^
+			crc32c_table[4][(word >> 24) & 0xFF] ^
+			crc32c_table[3][(word >> 32) & 0xFF] ^
+			crc32c_table[2][(word >> 40) & 0xFF] ^
+			crc32c_table[1][(word >> 48) & 0xFF] ^
+			crc32c_table[0][word >> 56];
+	}
+	for (; size > 0; size--, p++)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p) & 0xFF];
+	return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t CRC32CHardware(uint32_t crc, const uint8_t *p, size_t size) {
+	uint64_t crc64 = crc;
+	for (; size >= 8; size -= 8, p += 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+	for (; size > 0; size--, p++)
+		crc = __builtin_ia32_crc32qi(crc, *p);
+	return crc;
+}
+
+#endif
+
+typedef uint32_t (*CRC32CFunction)(uint32_t crc, const uint8_t *p, size_t size);
+
+static CRC32CFunction SelectImplementation() {
+	InitializeTables();
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		return CRC32CHardware;
+#endif
+	return CRC32CSoftware;
+}
+
+// Selected when the program starts, before any threads are created.
+static CRC32CFunction crc32c_function = SelectImplementation();
+
+uint32_t CRC32C(uint32_t crc, const void *data, size_t size) {
+	return ~crc32c_function(~crc, (const uint8_t *)data, size);
+}
+
+bool CRC32CIsAccelerated() {
+	return crc32c_function != CRC32CSoftware;
+}
+
+void StampBlock(char *block, size_t size, uint64_t offset, uint64_t generation,
+uint32_t worker, uint64_t sequence) {
+	BlockHeader *h = (BlockHeader *)block;
+	h->magic = BLOCK_HEADER_MAGIC;
+	h->offset = offset;
+	h->generation = generation;
+	h->sequence = sequence;
+	h->worker = worker;
+	h->checksum = 0;
+	h->checksum = CRC32C(0, block, size);
+}
+
+int CheckBlock(const char *block, size_t size, uint64_t offset, uint64_t generation) {
+	const BlockHeader *h = (const BlockHeader *)block;
+	// The checksum is calculated with the checksum field zeroed, which is done
+	// by checksumming the header separately.
+	BlockHeader header = *h;
+	header.checksum = 0;
+	uint32_t crc = CRC32C(0, &header, sizeof(BlockHeader));
+	crc = CRC32C(crc, block + sizeof(BlockHeader), size - sizeof(BlockHeader));
+	if (crc != h->checksum) {
+		if (h->magic != BLOCK_HEADER_MAGIC)
+			return VERIFY_NO_HEADER;
+		return VERIFY_BAD_CHECKSUM;
+	}
+	if (h->offset != offset)
+		return VERIFY_WRONG_OFFSET;
+	if (h->generation != generation)
+		return VERIFY_STALE;
+	return VERIFY_OK;
+}
+
+const char *GetVerifyResultDescription(int result) {
+	return verify_result_description[result];
+}
+
+#define UNUSED_ENTRY (~(uint64_t)0)
+
+static inline uint64_t HashOffset(uint64_t offset) {
+	return offset * 0x9E3779B97F4A7C15ULL;
+}
+
+WriteOrderTracker::WriteOrderTracker() {
+	max_in_flight = 0;
+	in_flight_offset = NULL;
+	in_flight_sequence = NULL;
+	table_size = 0;
+	table_offset = NULL;
+	table_sequence = NULL;
+	Reset(0);
+}
+
+WriteOrderTracker::~WriteOrderTracker() {
+	delete [] in_flight_offset;
+	delete [] in_flight_sequence;
+	delete [] table_offset;
+	delete [] table_sequence;
+}
+
+void WriteOrderTracker::Reset(int _max_in_flight) {
+	if (_max_in_flight > max_in_flight) {
+		delete [] in_flight_offset;
+		delete [] in_flight_sequence;
+		in_flight_offset = new uint64_t[_max_in_flight];
+		in_flight_sequence = new uint64_t[_max_in_flight];
+	}
+	max_in_flight = _max_in_flight;
+	nu_in_flight = 0;
+	if (table_size == 0) {
+		table_size = 1024;
+		table_offset = new uint64_t[table_size];
+		table_sequence = new uint64_t[table_size];
+	}
+	memset(table_offset, 0xFF, table_size * sizeof(uint64_t));
+	nu_entries = 0;
+}
+
+// Return the index of the entry of the given offset, or of the unused entry
+// where it would be added.
+
+uint64_t WriteOrderTracker::FindEntry(uint64_t offset) const {
+	uint64_t i = (HashOffset(offset) >> 32) & (table_size - 1);
+	while (table_offset[i] != offset && table_offset[i] != UNUSED_ENTRY)
+		i = (i + 1) & (table_size - 1);
+	return i;
+}
+
+void WriteOrderTracker::AddEntry(uint64_t offset, uint64_t sequence) {
+	if ((nu_entries + 1) * 2 > table_size) {
+		// Double the size of the table.
+		uint64_t *old_offset = table_offset;
+		uint64_t *old_sequence = table_sequence;
+		uint64_t old_size = table_size;
+		table_size *= 2;
+		table_offset = new uint64_t[table_size];
+		table_sequence = new uint64_t[table_size];
+		memset(table_offset, 0xFF, table_size * sizeof(uint64_t));
+		for (uint64_t i = 0; i < old_size; i++)
+			if (old_offset[i] != UNUSED_ENTRY) {
+				uint64_t j = FindEntry(old_offset[i]);
+				table_offset[j] = old_offset[i];
+				table_sequence[j] = old_sequence[i];
+			}
+		delete [] old_offset;
+		delete [] old_sequence;
+	}
+	uint64_t i = FindEntry(offset);
+	table_offset[i] = offset;
+	table_sequence[i] = sequence;
+	nu_entries++;
+}
+
+void WriteOrderTracker::WriteQueued(uint64_t offset, uint64_t sequence) {
+	in_flight_offset[nu_in_flight] = offset;
+	in_flight_sequence[nu_in_flight] = sequence;
+	nu_in_flight++;
+}
+
+void WriteOrderTracker::WriteCompleted(const void *buffer, size_t size, uint64_t offset) {
+	uint64_t sequence = ((const BlockHeader *)buffer)->sequence;
+	bool overtaken = false;
+	for (int i = 0; i < nu_in_flight;) {
+		if (in_flight_offset[i] == offset && in_flight_sequence[i] == sequence) {
+			nu_in_flight--;
+			in_flight_offset[i] = in_flight_offset[nu_in_flight];
+			in_flight_sequence[i] = in_flight_sequence[nu_in_flight];
+			continue;
+		}
+		// An earlier write to the same block is still in flight.
+		if (in_flight_offset[i] == offset && in_flight_sequence[i] < sequence)
+			overtaken = true;
+		i++;
+	}
+	uint64_t i = FindEntry(offset);
+	if (table_offset[i] == offset)
+		table_sequence[i] = sequence;
+	else if (overtaken)
+		AddEntry(offset, sequence);
+}
+
+bool WriteOrderTracker::GetLastCompletedWrite(uint64_t offset, uint64_t *sequence) const {
+	if (nu_entries == 0)
+		return false;
+	uint64_t i = FindEntry(offset);
+	if (table_offset[i] != offset)
+		return false;
+	*sequence = table_sequence[i];
+	return true;
+}
@@ -0,0 +1,106 @@
+/*
+
+Copyright (c) 2014 Harm Hanemaaijer <fgenfb@yahoo.com>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+*/
+
+// Data integrity verification (--verify). Requires stdint.h and io-engine.h
+// to be included first.
+//
+// Every block written by a write test starts with a header identifying the
+// write, followed by the data pattern. The header contains a CRC32C checksum
+// of the whole block (computed with the checksum field set to zero), so that
+// any corruption of the block can be detected when it is read back, while the
+// other fields identify misdirected writes and stale data.
+
+#define BLOCK_HEADER_MAGIC 0x4B4C424846534C46ULL	// "FLSFHBLK"
+
+class BlockHeader {
+public :
+	uint64_t magic;
+	uint64_t offset;	// Byte offset of the block in the test file.
+	uint64_t generation;	// Identifies the test (and run) that wrote the block.
+	uint64_t sequence;	// Transaction index of the write within the test.
+	uint32_t worker;	// Index of the worker thread that wrote the block.
+	uint32_t checksum;
+};
+
+enum {
+	VERIFY_OK = 0,
+	VERIFY_NO_HEADER = 1,		// The block was not written by flash-bench.
+	VERIFY_WRONG_OFFSET = 2,	// The block belongs at another offset.
+	VERIFY_BAD_CHECKSUM = 3,	// The contents of the block are corrupted.
+	VERIFY_STALE = 4,		// The block is intact, but from an earlier write.
+	NU_VERIFY_RESULTS
+};
+
+// Compute the CRC32C (Castagnoli) checksum of data, continuing from crc (0 for
+// the start of the data). The SSE 4.2 crc32 instruction is used when the
+// processor supports it.
+
+uint32_t CRC32C(uint32_t crc, const void *data, size_t size);
+
+// Return whether CRC32C() uses hardware acceleration.
+
+bool CRC32CIsAccelerated();
+
+// Write a header at the start of a block and compute its checksum.
+
+void StampBlock(char *block, size_t size, uint64_t offset, uint64_t generation,
+	uint32_t worker, uint64_t sequence);
+
+// Check the header and checksum of a block read from the given offset, which
+// should have been written with the given generation. Returns VERIFY_OK or
+// the kind of error; checking whether the sequence number of an intact block
+// is the expected one is left to the caller.
+
+int CheckBlock(const char *block, size_t size, uint64_t offset, uint64_t generation);
+
+const char *GetVerifyResultDescription(int result);
+
+// Tracks the order in which the stamped writes of a worker complete with an
+// asynchronous engine. Writes to the same block that are in flight at the same
+// time may complete in any order, and the block then holds the write that
+// completed last rather than the one issued last. Since that is rare, only
+// blocks for which it happened are remembered, with the sequence number of
+// the write that completed last.
+
+class WriteOrderTracker : public WriteCompletionObserver {
+private :
+	// The writes in flight.
+	int nu_in_flight;
+	int max_in_flight;
+	uint64_t *in_flight_offset;
+	uint64_t *in_flight_sequence;
+	// Open addressing hash table of the blocks written out of order.
+	uint64_t table_size;	// A power of two.
+	uint64_t nu_entries;
+	uint64_t *table_offset;	// ~0 for an unused entry.
+	uint64_t *table_sequence;
+
+	uint64_t FindEntry(uint64_t offset) const;
+	void AddEntry(uint64_t offset, uint64_t sequence);
+public :
+	WriteOrderTracker();
+	~WriteOrderTracker();
+	// Start tracking with at most max_in_flight writes outstanding at a time.
+	void Reset(int max_in_flight);
+	// Called before a stamped write is passed to the engine.
+	void WriteQueued(uint64_t offset, uint64_t sequence);
+	void WriteCompleted(const void *buffer, size_t size, uint64_t offset);
+	// Return whether writes to the block at the given offset completed out of
+	// order, and if so, the sequence number of the write that completed last.
+	bool GetLastCompletedWrite(uint64_t offset, uint64_t *sequence) const;
+};